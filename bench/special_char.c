@@ -0,0 +1,144 @@
+/***********************************************************************/
+/* special_char.c                                                      */
+/* --------------                                                      */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Benchmark of find_special_char() against a byte by byte loop   */
+/*                                                                     */
+/*      The received data is cut in runs the way put_chars() does it:  */
+/*      a special character, then the run of plain ones after it.      */
+/*      Both searches must find the same runs.                         */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "special_char.h"
+
+#define DATA_SIZE (4 * 1024 * 1024)
+#define CHUNK_SIZE 4096           /* like a read() of the port */
+#define ROUNDS 20
+
+typedef unsigned int (*search_func)(const char *, unsigned int, gboolean, gboolean);
+
+static unsigned int scalar_special_char(const char *chars, unsigned int size, gboolean crlf_auto, gboolean esc_clear_screen)
+{
+	unsigned int i;
+
+	for(i = 0; i < size; i++)
+	{
+		if(is_special_char(chars[i], crlf_auto, esc_clear_screen))
+			break;
+	}
+
+	return i;
+}
+
+/* Returns a checksum of the runs found */
+static guint64 scan(search_func search, const char *data, gsize size, gboolean crlf_auto, gboolean esc_clear_screen)
+{
+	gsize offset, i, length;
+	guint64 sum = 0;
+	unsigned int run;
+
+	for(offset = 0; offset < size; offset += CHUNK_SIZE)
+	{
+		length = MIN(CHUNK_SIZE, size - offset);
+		for(i = 0; i < length; )
+		{
+			i++;
+			run = search(data + offset + i, length - i, crlf_auto, esc_clear_screen);
+			sum = sum * 31 + run;
+			i += run;
+		}
+	}
+
+	return sum;
+}
+
+static gdouble measure(search_func search, const char *data, gsize size, gboolean crlf_auto, gboolean esc_clear_screen, guint64 *sum)
+{
+	gint64 start;
+	guint i;
+
+	start = g_get_monotonic_time();
+	for(i = 0; i < ROUNDS; i++)
+		*sum = scan(search, data, size, crlf_auto, esc_clear_screen);
+
+	/* in MB/s */
+	return (gdouble)size * ROUNDS / (g_get_monotonic_time() - start);
+}
+
+/* Lines of printable text ending with CR LF, or random bytes */
+static void fill(char *data, gsize size, gint line_length)
+{
+	gsize i;
+
+	for(i = 0; i < size; i++)
+	{
+		if(line_length == 0)
+			data[i] = rand();
+		else if(i % line_length == (gsize)line_length - 2)
+			data[i] = '\r';
+		else if(i % line_length == (gsize)line_length - 1)
+			data[i] = '\n';
+		else
+			data[i] = ' ' + rand() % 95;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct
+	{
+		const gchar *name;
+		gint line_length;
+	}
+	inputs[] =
+	{
+		{"text, 16 chars lines", 16},
+		{"text, 80 chars lines", 80},
+		{"text, 1000 chars lines", 1000},
+		{"random bytes", 0}
+	};
+	char *data;
+	guint i;
+	gint options;
+	guint64 sum_scalar, sum_swar;
+	gdouble scalar, swar;
+	gboolean failed = FALSE;
+
+	data = g_malloc(DATA_SIZE);
+	srand(1);
+
+	printf("%-24s %-14s %12s %12s %8s\n", "input", "options", "scalar MB/s", "SWAR MB/s", "speedup");
+	for(i = 0; i < G_N_ELEMENTS(inputs); i++)
+	{
+		fill(data, DATA_SIZE, inputs[i].line_length);
+
+		/* bit 0: auto CR/LF, bit 1: ESC clears the screen */
+		for(options = 0; options < 4; options++)
+		{
+			scalar = measure(scalar_special_char, data, DATA_SIZE, options & 1, options & 2, &sum_scalar);
+			swar = measure(find_special_char, data, DATA_SIZE, options & 1, options & 2, &sum_swar);
+
+			printf("%-24s %-14s %12.0f %12.0f %7.1fx%s\n", inputs[i].name,
+			       options == 0 ? "LF" : options == 1 ? "LF CR" : options == 2 ? "LF ESC" : "LF CR ESC",
+			       scalar, swar, swar / scalar,
+			       sum_scalar != sum_swar ? "  MISMATCH" : "");
+			if(sum_scalar != sum_swar)
+				failed = TRUE;
+		}
+	}
+
+	g_free(data);
+
+	return failed ? 1 : 0;
+}
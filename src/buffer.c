@@ -17,204 +17,639 @@
 /*                                                                     */
 /***********************************************************************/
 
+#include <gtk/gtk.h>
 #include <glib.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include "buffer.h"
+#include "interface.h"
 #include "i18n.h"
 #include "serial.h"
+#include "special_char.h"
+#include "timestamp.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
-#include <time.h>
-
-#define TIMESTAMP_SIZE 50
 
 extern gboolean timestamp_on;
 static int need_to_write_timestamp = 0;
-static char *buffer = NULL;
-static char *current_buffer;
-static unsigned int pointer;
+
+/* The history is a ring split in chunks. In memory, a chunk is only    */
+/* allocated when data is written to it for the 1st time. With a spill  */
+/* file, the chunks are segments of a preallocated file and only the    */
+/* last BUFFER_HOT_CHUNKS used are mapped, so the memory use is bounded */
+typedef struct
+{
+	char **chunks;               /* NULL when not allocated or not mapped */
+	guint chunks_number;
+	guint chunk_size;
+	guint64 size;
+	gchar *file;
+	int fd;                      /* -1 when the history is in memory */
+	guint hot[BUFFER_HOT_CHUNKS];
+	guint hot_next;              /* next mapped chunk to be unmapped */
+} history_t;
+
+#define NO_CHUNK G_MAXUINT
+
+static history_t history = {NULL, 0, 0, 0, NULL, -1};
+/* Why the history file was given up, reported from the main loop */
+static gchar *spill_file = NULL;
+static int spill_error = 0;
+static guint64 pointer;
+/* Data written to the ring which has not been given to write_func yet */
+static guint64 pending_size = 0;
+/* Bytes written since the last clear, gives the offset of the oldest one */
+static guint64 total_written = 0;
 static int cr_received = 0;
+/* Received bytes since the last frame boundary */
+static guint frame_bytes = 0;
 char overlapped;
 
-extern guint virt_col_pos;
-
 
 void (*write_func)(const char *, unsigned int) = NULL;
 void (*clear_func)(void) = NULL;
 
-void create_buffer(void)
+static char *chunk_get(history_t *h, guint index)
+{
+	char *chunk;
+	guint old;
+
+	if(h->chunks[index] != NULL)
+		return h->chunks[index];
+
+	if(h->fd == -1)
+	{
+		h->chunks[index] = g_malloc(h->chunk_size);
+		return h->chunks[index];
+	}
+
+	chunk = mmap(NULL, h->chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	             h->fd, (off_t)index * h->chunk_size);
+	if(chunk == MAP_FAILED)
+	{
+		perror("mmap");
+		return NULL;
+	}
+
+	/* unmap the least recently mapped segment, the kernel writes it back */
+	old = h->hot[h->hot_next];
+	if(old != NO_CHUNK)
+	{
+		munmap(h->chunks[old], h->chunk_size);
+		h->chunks[old] = NULL;
+	}
+	h->hot[h->hot_next] = index;
+	h->hot_next = (h->hot_next + 1) % BUFFER_HOT_CHUNKS;
+
+	h->chunks[index] = chunk;
+	return chunk;
+}
+
+/* Give length bytes of the ring, starting at start, to func */
+static void write_spans(void (*func)(const char *, unsigned int),
+                        history_t *h, guint64 start, guint64 length)
+{
+	guint span;
+	char *chunk;
+
+	while(length > 0)
+	{
+		span = MIN(length, h->chunk_size - start % h->chunk_size);
+
+		chunk = chunk_get(h, start / h->chunk_size);
+		if(chunk != NULL)
+			func(chunk + start % h->chunk_size, span);
+
+		length -= span;
+		start += span;
+		if(start == h->size)
+			start = 0;
+	}
+}
+
+static gboolean history_open(history_t *h, guint64 size, const gchar *file)
 {
-	if(buffer == NULL)
+	guint i;
+	int error;
+
+	h->fd = -1;
+	h->file = NULL;
+	h->chunk_size = BUFFER_CHUNK_SIZE;
+
+	if(file != NULL && file[0] != 0)
 	{
-		buffer = malloc(BUFFER_SIZE);
-		clear_buffer();
+		/* never an existing file. The name is removed at once: the file */
+		/* goes away with the descriptor, and the name is free again     */
+		/* while the previous history is copied from the old one         */
+		h->fd = open(file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if(h->fd == -1)
+			return FALSE;
+		unlink(file);
+		h->file = g_strdup(file);
+		h->chunk_size = BUFFER_SEGMENT_SIZE;
 	}
+
+	h->size = ((size + h->chunk_size - 1) / h->chunk_size) * h->chunk_size;
+
+	if(h->fd != -1)
+	{
+		/* no sparse file: once the disk is full, writing to a hole */
+		/* through the mapping would raise SIGBUS                   */
+		error = posix_fallocate(h->fd, 0, h->size);
+		if(error != 0)
+		{
+			close(h->fd);
+			g_free(h->file);
+			errno = error;
+			return FALSE;
+		}
+	}
+
+	h->chunks_number = h->size / h->chunk_size;
+	h->chunks = g_new0(char *, h->chunks_number);
+	for(i = 0; i < BUFFER_HOT_CHUNKS; i++)
+		h->hot[i] = NO_CHUNK;
+	h->hot_next = 0;
+
+	return TRUE;
+}
+
+static void history_close(history_t *h)
+{
+	guint i;
+
+	if(h->chunks == NULL)
+		return;
+
+	for(i = 0; i < h->chunks_number; i++)
+	{
+		if(h->chunks[i] == NULL)
+			continue;
+		if(h->fd == -1)
+			g_free(h->chunks[i]);
+		else
+			munmap(h->chunks[i], h->chunk_size);
+	}
+	g_free(h->chunks);
+	h->chunks = NULL;
+
+	if(h->fd != -1)
+		close(h->fd);
+	h->fd = -1;
+	g_free(h->file);
+	h->file = NULL;
+}
+
+static void ring_write(const char *, unsigned int);
+
+void create_buffer(void)
+{
+	if(history.chunks == NULL)
+		set_buffer_storage(DEFAULT_BUFFER_SIZE, NULL);
 	return;
 }
 
 void delete_buffer(void)
 {
-	if(buffer != NULL)
-		free(buffer);
+	history_close(&history);
 	return;
 }
 
-//assumes that buffer always has space for timestamp (TIMESTAMP_SIZE)
-//buffer points to location where timestamp will be inserted
-unsigned int insert_timestamp(char *buffer)
+/* Change the size of the history, and the file it is kept in (NULL or */
+/* empty to keep it in memory), keeping its most recent part           */
+gboolean set_buffer_storage(unsigned int size_kb, const gchar *file)
 {
-  unsigned int size = 0;
+	history_t old, new_history;
+	guint64 old_pointer, keep, written;
+	gboolean spill = (file != NULL && file[0] != 0);
+	guint chunk_size = spill ? BUFFER_SEGMENT_SIZE : BUFFER_CHUNK_SIZE;
 
-	if(timestamp_on)
+	size_kb = CLAMP(size_kb, BUFFER_MIN_SIZE, spill ? BUFFER_MAX_FILE_SIZE : BUFFER_MAX_SIZE);
+
+	if(history.chunks != NULL &&
+	   history.size == (((guint64)size_kb * 1024 + chunk_size - 1) / chunk_size) * chunk_size &&
+	   g_strcmp0(history.file, spill ? file : NULL) == 0)
+		return TRUE;
+
+	if(!history_open(&new_history, (guint64)size_kb * 1024, file))
+		return FALSE;
+
+	old = history;
+	old_pointer = pointer;
+	keep = MIN(overlapped ? old.size : old_pointer, new_history.size);
+
+	history = new_history;
+	pointer = 0;
+	pending_size = 0;
+	overlapped = 0;
+	cr_received = 0;
+
+	if(old.chunks == NULL)
+		return TRUE;
+
+	/* the segments which cannot be mapped any more are left out */
+	written = total_written;
+	write_spans(ring_write, &old, (old_pointer + old.size - keep) % old.size, keep);
+	pending_size = 0;
+	total_written = written;
+
+	history_close(&old);
+
+	return TRUE;
+}
+
+void get_buffer_usage(guint64 *used, guint64 *resident, guint64 *size)
+{
+	guint i, number = 0;
+
+	for(i = 0; i < history.chunks_number; i++)
 	{
-		char buf[TIMESTAMP_SIZE];
-		struct timespec ts;
-		int d,h,m,s,x;
-		timespec_get(&ts, TIME_UTC);
-		d = (ts.tv_sec / (3600 * 24));
-		h = (ts.tv_sec / 3600) % 24;
-		m = (ts.tv_sec / 60 ) % 60;
-		s = ts.tv_sec % 60;
-		x = ts.tv_nsec / 1000000;
-		snprintf(buf, TIMESTAMP_SIZE - 1, "[%d.%02uh.%02um.%02us.%03u] "
-				, d, h, m, s, x );
-		strcpy(buffer, buf);
-		size = strlen(buf);
+		if(history.chunks[i] != NULL)
+			number++;
 	}
-  return size;
+
+	*used = overlapped ? history.size : pointer;
+	*resident = (guint64)number * history.chunk_size;
+	*size = history.size;
 }
 
-void put_chars(const char *chars, unsigned int size, gboolean crlf_auto, gboolean esc_clear_screen)
+const gchar *get_buffer_file(void)
+{
+	return history.file;
+}
+
+static gboolean spill_report(gpointer data)
+{
+	gchar *message;
+
+	message = g_strdup_printf(_("Cannot map the history file %s: %s\nThe history is now kept in memory\n"), spill_file, strerror(spill_error));
+	show_message(message, MSG_ERR);
+	g_free(message);
+	g_free(spill_file);
+	spill_file = NULL;
+
+	return FALSE;
+}
+
+static void flush_pending(void);
+
+/* A segment of the history file cannot be mapped: the history goes back */
+/* to memory with what can still be read of it, before anything is lost  */
+static void history_to_memory(void)
 {
-	// buffer must still be valid after cr conversion or adding timestamp
-	// only pointer is copied below
-	char out_buffer[(BUFFER_RECEPTION*2) + TIMESTAMP_SIZE];
-	const char *characters;
+	int cr = cr_received;
+
+	if(spill_file == NULL)
+		g_idle_add(spill_report, NULL);
+	g_free(spill_file);
+	spill_error = errno;
+	spill_file = g_strdup(history.file);
+
+	flush_pending();
+	set_buffer_storage(MIN(history.size / 1024, BUFFER_MAX_SIZE), NULL);
+	cr_received = cr;
+}
 
-	/* If the auto CR LF mode on, read the buffer to add \r before \n */
-	if(crlf_auto || timestamp_on || esc_clear_screen)
+/* Hand the data written since the last flush to the display, straight */
+/* from the ring, one span per chunk                                    */
+static void flush_pending(void)
+{
+	if(pending_size == 0)
+		return;
+
+	if(write_func != NULL)
+		write_spans(write_func, &history,
+		            (pointer + history.size - pending_size) % history.size,
+		            pending_size);
+	pending_size = 0;
+}
+
+static void ring_write(const char *chars, unsigned int size)
+{
+	guint length;
+	char *chunk;
+
+	while(size > 0)
 	{
-		int i, out_size = 0;
+		length = MIN(size, history.chunk_size - pointer % history.chunk_size);
 
-		for (i=0; i<size; i++)
+		/* never overwrite data which has not been displayed yet */
+		if(pending_size + length > history.size)
+			flush_pending();
+
+		chunk = chunk_get(&history, pointer / history.chunk_size);
+		if(chunk == NULL)
+		{
+			history_to_memory();
+			continue;
+		}
+		memcpy(chunk + pointer % history.chunk_size, chars, length);
+		chars += length;
+		size -= length;
+		pointer += length;
+		pending_size += length;
+		total_written += length;
+
+		if(pointer == history.size)
 		{
-			if(esc_clear_screen && chars[i] == '\x1b')
+			pointer = 0;
+			overlapped = 1;
+		}
+	}
+}
+
+static inline void ring_put_char(char c)
+{
+	char *chunk;
+
+	if(pending_size == history.size)
+		flush_pending();
+
+	chunk = chunk_get(&history, pointer / history.chunk_size);
+	if(chunk == NULL)
+	{
+		history_to_memory();
+		chunk = chunk_get(&history, pointer / history.chunk_size);
+	}
+	chunk[pointer % history.chunk_size] = c;
+	pointer++;
+	pending_size++;
+	total_written++;
+
+	if(pointer == history.size)
+	{
+		pointer = 0;
+		overlapped = 1;
+	}
+}
+
+static void ring_put_timestamp(void)
+{
+	char buf[TIMESTAMP_SIZE];
+
+	if(!timestamp_on)
+		return;
+
+	ring_write(buf, timestamp_format(buf, sizeof(buf)));
+}
+
+/* CR/LF normalisation and timestamping of one received character */
+static void transform_char(char c, gboolean crlf_auto)
+{
+	if(crlf_auto)
+	{
+		if (c == '\r')
+		{
+			/* If the previous character was a CR too, insert a newline */
+			if (cr_received)
 			{
-				clear_buffer();
-				continue;
+				ring_put_char('\n');
+				need_to_write_timestamp = 1;
 			}
-			if(crlf_auto)
+			cr_received = 1;
+		}
+		else
+		{
+			if (c == '\n')
 			{
-				if (chars[i] == '\r')
-				{
-					/* If the previous character was a CR too, insert a newline */
-					if (cr_received)
-					{
-						out_buffer[out_size] = '\n';
-						out_size++;
-						need_to_write_timestamp = 1;
-					}
-					cr_received = 1;
-				}
-				else
+				/* If we get a newline without a CR first, insert a CR */
+				if (!cr_received)
+					ring_put_char('\r');
+			}
+			else
+			{
+				/* If we receive a normal char, and the previous one was a
+				   CR insert a newline */
+				if (cr_received)
 				{
-					if (chars[i] == '\n')
-					{
-						/* If we get a newline without a CR first, insert a CR */
-						if (!cr_received)
-						{
-							out_buffer[out_size] = '\r';
-							out_size++;
-						}
-					}
-					else
-					{
-						/* If we receive a normal char, and the previous one was a
-						   CR insert a newline */
-						if (cr_received)
-						{
-							out_buffer[out_size] = '\n';
-							out_size++;
-							need_to_write_timestamp = 1;
-						}
-					}
-					cr_received = 0;
+					ring_put_char('\n');
+					need_to_write_timestamp = 1;
 				}
-			} //if crlf_auto
-
-			if(need_to_write_timestamp)
-			{
-				out_size += insert_timestamp(&out_buffer[out_size]);
-				need_to_write_timestamp = 0;
 			}
+			cr_received = 0;
+		}
+	} //if crlf_auto
 
-			if(chars[i] == '\n' )
-			{
-				need_to_write_timestamp = 1; //remember until we have a new character to print
-			}
+	if(need_to_write_timestamp)
+	{
+		ring_put_timestamp();
+		need_to_write_timestamp = 0;
+	}
 
-			//copy each character to new buffer
-			out_buffer[out_size] = chars[i];
-			out_size++; // increment for each stored character
+	if(c == '\n' )
+	{
+		need_to_write_timestamp = 1; //remember until we have a new character to print
+	}
 
-		} // for
+	ring_put_char(c);
+}
 
-		// set "incoming" data pointer to new buffer containing all normal and
-		// converted newline characters
-		chars = out_buffer;
-		size = out_size;
-	} // if(crlf_auto || timestamp_on || esc_clear_screen)
+/* An ESC clears the screen. What came before it in the same chunk is */
+/* kept, as when the whole chunk was transformed before being stored:  */
+/* the data not given to the display yet is written again after it    */
+static void clear_keeping_pending(void)
+{
+	guint64 used = overlapped ? history.size : pointer;
+	guint length = pending_size;
+	char *kept;
+
+	kept = g_malloc(MAX(length, 1));
+	length = read_buffer(used - length, kept, length);
+	clear_buffer();
+	ring_write(kept, length);
+	g_free(kept);
+}
+
+/* The received data goes through the transform stages straight into the */
+/* ring, then the display (and the log) reads it from there              */
+void put_chars(const char *chars, unsigned int size, gboolean crlf_auto, gboolean esc_clear_screen)
+{
+	unsigned int i, run;
 
-	if(buffer == NULL)
+	if(history.chunks == NULL)
 	{
 		i18n_printf(_("ERROR : Buffer is not initialized !\n"));
 		return;
 	}
 
-	// when incoming size is larger than buffer, then just print the
-	// last BUFFER_SIZE characters and ignore all other at begin of buffer
-	if(size > BUFFER_SIZE)
+	frame_bytes += size;
+
+	if(timestamp_on)
+		timestamp_sample();
+
+	if(!crlf_auto && !timestamp_on && !esc_clear_screen)
 	{
-		characters = chars + (size - BUFFER_SIZE);
-		size = BUFFER_SIZE;
+		ring_write(chars, size);
+		flush_pending();
+		return;
 	}
-	else
-		characters = chars;
 
-	if((size + pointer) >= BUFFER_SIZE)
+	for (i=0; i<size; )
 	{
-		memcpy(current_buffer, characters, BUFFER_SIZE - pointer);
-		chars = characters + BUFFER_SIZE - pointer;
-		pointer = size - (BUFFER_SIZE - pointer);
-		memcpy(buffer, chars, pointer);
-		current_buffer = buffer + pointer;
-		overlapped = 1;
+		if(esc_clear_screen && chars[i] == '\x1b')
+		{
+			clear_keeping_pending();
+			i++;
+			continue;
+		}
+
+		transform_char(chars[i], crlf_auto);
+		i++;
+
+		/* After a normal character there is no pending CR nor
+		   timestamp, so the following normal characters are
+		   copied as they are, in one go */
+		if(!is_special_char(chars[i - 1], crlf_auto, esc_clear_screen))
+		{
+			run = find_special_char(&chars[i], size - i, crlf_auto, esc_clear_screen);
+			ring_write(&chars[i], run);
+			i += run;
+		}
 	}
-	else
+
+	flush_pending();
+}
+
+/* Ends the current frame: what is received next starts on a new line, */
+/* with its timestamp                                                   */
+void put_frame_break(gboolean show_size)
+{
+	char buf[32];
+	int size;
+
+	if(history.chunks == NULL || frame_bytes == 0)
+		return;
+
+	if(show_size)
 	{
-		memcpy(current_buffer, characters, size);
-		pointer += size;
-		current_buffer += size;
+		size = g_snprintf(buf, sizeof(buf), " (%u)", frame_bytes);
+		ring_write(buf, MIN(size, (int)sizeof(buf) - 1));
 	}
+	ring_write("\r\n", 2);
 
-	if(write_func != NULL)
-		write_func(characters, size);
+	cr_received = 0;
+	need_to_write_timestamp = 1;
+	frame_bytes = 0;
+
+	flush_pending();
 }
 
 void write_buffer(void)
 {
-	if(write_func == NULL)
+	if(write_func == NULL || history.chunks == NULL)
 		return;
 
+	/* the segments are streamed in order, without reading all of them */
 	if(overlapped == 0)
-		write_func(buffer, pointer);
+		write_spans(write_func, &history, 0, pointer);
 	else
+		write_spans(write_func, &history, pointer, history.size);
+}
+
+/* Give the history to write_func, from offset bytes after its oldest byte */
+void write_buffer_from(guint64 offset)
+{
+	guint64 used;
+
+	if(write_func == NULL || history.chunks == NULL)
+		return;
+
+	used = overlapped ? history.size : pointer;
+	if(offset >= used)
+		return;
+
+	write_spans(write_func, &history,
+	            ((overlapped ? pointer : 0) + offset) % history.size,
+	            used - offset);
+}
+
+/* Offset, from the oldest byte of the history, of the beginning of its */
+/* last lines lines. Only the last max_bytes bytes are looked at        */
+guint64 buffer_tail_offset(guint lines, guint64 max_bytes)
+{
+	guint64 used, oldest, offset, limit, position;
+	guint span, i;
+	char *chunk;
+
+	if(history.chunks == NULL)
+		return 0;
+
+	used = overlapped ? history.size : pointer;
+	oldest = overlapped ? pointer : 0;
+	limit = used - MIN(max_bytes, used);
+	offset = used;
+
+	if(lines == 0)
+		return used;
+
+	/* walk backwards, one chunk at a time */
+	while(offset > limit)
+	{
+		position = (oldest + offset - 1) % history.size;
+		span = MIN(offset - limit, position % history.chunk_size + 1);
+
+		chunk = chunk_get(&history, position / history.chunk_size);
+		if(chunk != NULL)
+		{
+			chunk += position % history.chunk_size;
+			for(i = 0; i < span; i++)
+			{
+				if(*(chunk - i) == '\n' && --lines == 0)
+					return offset - i;
+			}
+		}
+		offset -= span;
+	}
+
+	return offset;
+}
+
+/* Copy up to size bytes of the history, from offset bytes after its */
+/* oldest byte, returns the number of bytes copied                    */
+guint read_buffer(guint64 offset, char *dest, guint size)
+{
+	guint64 used, position;
+	guint span, done = 0;
+	char *chunk;
+
+	if(history.chunks == NULL)
+		return 0;
+
+	used = overlapped ? history.size : pointer;
+	if(offset >= used)
+		return 0;
+	size = MIN(size, used - offset);
+	position = ((overlapped ? pointer : 0) + offset) % history.size;
+
+	while(done < size)
 	{
-		write_func(current_buffer, BUFFER_SIZE - pointer);
-		write_func(buffer, pointer);
+		span = MIN(size - done, history.chunk_size - position % history.chunk_size);
+
+		chunk = chunk_get(&history, position / history.chunk_size);
+		if(chunk != NULL)
+			memcpy(dest + done, chunk + position % history.chunk_size, span);
+		else
+			memset(dest + done, 0, span);
+
+		done += span;
+		position += span;
+		if(position == history.size)
+			position = 0;
 	}
+
+	return done;
+}
+
+/* Number of bytes received since the last clear before the oldest one */
+/* still in the history                                                */
+guint64 get_buffer_start_offset(void)
+{
+	return total_written - (overlapped ? history.size : pointer);
 }
 
 void write_buffer_with_func(void (*func)(const char *, unsigned int))
@@ -232,16 +667,16 @@ void clear_buffer(void)
 	if(clear_func != NULL)
 		clear_func();
 
-	if(buffer == NULL)
+	if(history.chunks == NULL)
 		return;
 
+	/* only the indexes are reset, the old data is simply overwritten */
 	overlapped = 0;
-	memset(buffer, 0, BUFFER_SIZE);
-	current_buffer = buffer;
 	pointer = 0;
+	pending_size = 0;
+	total_written = 0;
 	cr_received = 0;
-
-	virt_col_pos = 0;
+	frame_bytes = 0;
 }
 
 void set_clear_func(void (*func)(void))
@@ -19,13 +19,27 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
-#define BUFFER_SIZE (128 * 1024)
+#define DEFAULT_BUFFER_SIZE 1024      /* in KiB */
+#define BUFFER_MIN_SIZE 64            /* in KiB */
+#define BUFFER_MAX_SIZE (1024 * 1024) /* in KiB */
+#define BUFFER_MAX_FILE_SIZE (64 * 1024 * 1024) /* in KiB */
+#define BUFFER_CHUNK_SIZE (64 * 1024)
+#define BUFFER_SEGMENT_SIZE (4 * 1024 * 1024)
+#define BUFFER_HOT_CHUNKS 8
 
 void create_buffer(void);
 void delete_buffer(void);
+gboolean set_buffer_storage(unsigned int, const gchar *);
+void get_buffer_usage(guint64 *, guint64 *, guint64 *);
+const gchar *get_buffer_file(void);
 void put_chars(const char *, unsigned int, gboolean, gboolean);
+void put_frame_break(gboolean);
 void clear_buffer(void);
 void write_buffer(void);
+void write_buffer_from(guint64);
+guint64 buffer_tail_offset(guint, guint64);
+guint read_buffer(guint64, char *, guint);
+guint64 get_buffer_start_offset(void);
 void set_display_func(void (*func)(const char *, unsigned int));
 void unset_display_func(void (*func)(const char *, unsigned int));
 void set_clear_func(void (*func)(void));
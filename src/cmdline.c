@@ -25,6 +25,10 @@
 #include "term_config.h"
 #include "files.h"
 #include "auto_config.h"
+#include "render.h"
+#include "buffer.h"
+#include "timestamp.h"
+#include "logging.h"
 #include "i18n.h"
 
 #include <config.h>
@@ -32,6 +36,26 @@
 
 extern struct configuration_port config;
 
+/* Options without a short form */
+enum
+{
+	OPTION_RX_THREAD = 256,
+	OPTION_RX_RING_SIZE,
+	OPTION_MAX_FPS,
+	OPTION_BUFFER_SIZE,
+	OPTION_BUFFER_FILE,
+	OPTION_TIMESTAMP_FORMAT,
+	OPTION_FRAME_GAP,
+	OPTION_FRAME_SIZE,
+	OPTION_LOW_LATENCY,
+	OPTION_VMIN,
+	OPTION_VTIME,
+	OPTION_CHAR_DELAY,
+	OPTION_SEND_RATE,
+	OPTION_LOG_BUFFER_SIZE,
+	OPTION_LOG_FLUSH_TIME
+};
+
 void display_help(void)
 {
 	i18n_printf(_("\nGTKTerm version %s\n"), VERSION);
@@ -49,12 +73,27 @@ void display_help(void)
 	i18n_printf(_("--flow <Xon | RTS | RS485> or -w : flow control (default none)\n"));
 	i18n_printf(_("--delay <ms> or -d : end of line delay in ms (default none)\n"));
 	i18n_printf(_("--char <char> or -r : wait for a special char at end of line (default none)\n"));
+	i18n_printf(_("--char-delay <us> : delay after each char of a sent file in us (default none)\n"));
+	i18n_printf(_("--send-rate <bytes/s> : rate limit of the sent files (default none)\n"));
+	i18n_printf(_("--log-buffer-size <KiB> : size of the log file buffers (default %d)\n"), DEFAULT_LOG_BUFFER_SIZE);
+	i18n_printf(_("--log-flush-time <ms> : maximum time before logged data is written to the file (default %d)\n"), DEFAULT_LOG_FLUSH_TIME);
 	i18n_printf(_("--file <filename> or -f : default file to send (default none)\n"));
 	i18n_printf(_("--rts_time_before <ms> or -x : for RS-485, time in ms before transmit with rts on\n"));
 	i18n_printf(_("--rts_time_after <ms> or -y : for RS-485, time in ms after transmit with rts on\n"));
 	i18n_printf(_("--echo or -e : switch on local echo\n"));
 	i18n_printf(_("--disable-port-lock or -L: does not lock serial port. Allows to send to serial port from different terminals\n"));
 	i18n_printf(_("                      Note: incoming data are displayed randomly on only one terminal\n"));
+	i18n_printf(_("--rx-thread : read the serial port in a dedicated thread\n"));
+	i18n_printf(_("--rx-ring-size <KiB> : size of the receive thread ring buffer (default %d)\n"), DEFAULT_RX_RING_SIZE);
+	i18n_printf(_("--max-fps <fps> : maximum terminal updates per second, -1 for every frame (default %d)\n"), DEFAULT_RENDER_FPS);
+	i18n_printf(_("--buffer-size <KiB> : size of the history kept for view changes and saving (default %d)\n"), DEFAULT_BUFFER_SIZE);
+	i18n_printf(_("--buffer-file <file> : keep the history in this file, mapped in memory a part at a time (the file must not exist, it is removed at once)\n"));
+	i18n_printf(_("--timestamp-format <epoch | local | iso8601 | relative | delta> : format of the timestamps (default epoch)\n"));
+	i18n_printf(_("--frame-gap <characters> : start a new line when nothing is received for this many character times (default none)\n"));
+	i18n_printf(_("--frame-size : show the size of the frames separated by --frame-gap\n"));
+	i18n_printf(_("--low-latency : ask the driver to deliver the received data without delay\n"));
+	i18n_printf(_("--vmin <bytes> : termios VMIN, bytes needed to wake the reception up (default %d)\n"), DEFAULT_VMIN);
+	i18n_printf(_("--vtime <1/10 s> : termios VTIME, inter-byte timeout, used with --rx-thread (default %d)\n"), DEFAULT_VTIME);
 	i18n_printf("\n");
 }
 
@@ -80,6 +119,21 @@ int read_command_line(int argc, char **argv, gchar *configuration_to_read)
 		{"rts_time_before", 1, 0, 'x'},
 		{"rts_time_after", 1, 0, 'y'},
 		{"config", 1, 0, 'c'},
+		{"rx-thread", 0, 0, OPTION_RX_THREAD},
+		{"rx-ring-size", 1, 0, OPTION_RX_RING_SIZE},
+		{"max-fps", 1, 0, OPTION_MAX_FPS},
+		{"buffer-size", 1, 0, OPTION_BUFFER_SIZE},
+		{"buffer-file", 1, 0, OPTION_BUFFER_FILE},
+		{"timestamp-format", 1, 0, OPTION_TIMESTAMP_FORMAT},
+		{"frame-gap", 1, 0, OPTION_FRAME_GAP},
+		{"frame-size", 0, 0, OPTION_FRAME_SIZE},
+		{"low-latency", 0, 0, OPTION_LOW_LATENCY},
+		{"vmin", 1, 0, OPTION_VMIN},
+		{"vtime", 1, 0, OPTION_VTIME},
+		{"char-delay", 1, 0, OPTION_CHAR_DELAY},
+		{"send-rate", 1, 0, OPTION_SEND_RATE},
+		{"log-buffer-size", 1, 0, OPTION_LOG_BUFFER_SIZE},
+		{"log-flush-time", 1, 0, OPTION_LOG_FLUSH_TIME},
 		{0, 0, 0, 0}
 	};
 
@@ -159,6 +213,66 @@ int read_command_line(int argc, char **argv, gchar *configuration_to_read)
 			config.rs485_rts_time_after_transmit = atoi(optarg);
 			break;
 
+		case OPTION_RX_THREAD:
+			config.rx_thread = TRUE;
+			break;
+
+		case OPTION_RX_RING_SIZE:
+			config.rx_ring_size = atoi(optarg);
+			break;
+
+		case OPTION_MAX_FPS:
+			config.render_fps = atoi(optarg);
+			break;
+
+		case OPTION_BUFFER_SIZE:
+			config.buffer_size = atoi(optarg);
+			break;
+
+		case OPTION_BUFFER_FILE:
+			g_strlcpy(config.buffer_file, optarg, sizeof(config.buffer_file));
+			break;
+
+		case OPTION_TIMESTAMP_FORMAT:
+			config.timestamp_format = timestamp_format_from_name(optarg);
+			break;
+
+		case OPTION_FRAME_GAP:
+			config.frame_gap = g_ascii_strtod(optarg, NULL);
+			break;
+
+		case OPTION_FRAME_SIZE:
+			config.frame_size = TRUE;
+			break;
+
+		case OPTION_LOW_LATENCY:
+			config.low_latency = TRUE;
+			break;
+
+		case OPTION_VMIN:
+			config.vmin = atoi(optarg);
+			break;
+
+		case OPTION_VTIME:
+			config.vtime = atoi(optarg);
+			break;
+
+		case OPTION_CHAR_DELAY:
+			config.char_delay = atoi(optarg);
+			break;
+
+		case OPTION_SEND_RATE:
+			config.send_rate = atoi(optarg);
+			break;
+
+		case OPTION_LOG_BUFFER_SIZE:
+			config.log_buffer_size = atoi(optarg);
+			break;
+
+		case OPTION_LOG_FLUSH_TIME:
+			config.log_flush_time = atoi(optarg);
+			break;
+
 		case 'h':
 			display_help();
 			return -1;
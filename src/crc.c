@@ -0,0 +1,109 @@
+/***********************************************************************/
+/* crc.c                                                               */
+/* -----                                                               */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      CRC-16 (XMODEM) and CRC-32 of the file transfer protocols      */
+/*                                                                     */
+/*      Both are computed four bytes at a time (slice-by-4) with       */
+/*      tables built on first use.                                     */
+/*                                                                     */
+/*      crc16_update(): polynomial 0x1021, MSB first, start with 0.    */
+/*      crc32_update(): polynomial 0xEDB88320, LSB first, start with   */
+/*      0xFFFFFFFF and invert the result, as ZMODEM does.              */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+
+#include "crc.h"
+
+static guint16 crc16_table[4][256];
+static guint32 crc32_table[4][256];
+static gsize tables_ready = 0;
+
+static void crc_tables_init(void)
+{
+	guint i, j, k;
+	guint16 c16;
+	guint32 c32;
+
+	for(i = 0; i < 256; i++)
+	{
+		c16 = i << 8;
+		c32 = i;
+		for(j = 0; j < 8; j++)
+		{
+			c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : c16 << 1;
+			c32 = (c32 & 1) ? (c32 >> 1) ^ 0xEDB88320 : c32 >> 1;
+		}
+		crc16_table[0][i] = c16;
+		crc32_table[0][i] = c32;
+	}
+
+	/* table k: the byte followed by k zeros */
+	for(k = 1; k < 4; k++)
+	{
+		for(i = 0; i < 256; i++)
+		{
+			c16 = crc16_table[k - 1][i];
+			crc16_table[k][i] = (c16 << 8) ^ crc16_table[0][c16 >> 8];
+			c32 = crc32_table[k - 1][i];
+			crc32_table[k][i] = (c32 >> 8) ^ crc32_table[0][c32 & 0xff];
+		}
+	}
+}
+
+static inline void crc_init(void)
+{
+	if(g_once_init_enter(&tables_ready))
+	{
+		crc_tables_init();
+		g_once_init_leave(&tables_ready, 1);
+	}
+}
+
+guint16 crc16_update(guint16 crc, const guint8 *data, gsize length)
+{
+	crc_init();
+
+	while(length >= 4)
+	{
+		crc = crc16_table[3][(crc >> 8) ^ data[0]] ^
+		      crc16_table[2][(crc & 0xff) ^ data[1]] ^
+		      crc16_table[1][data[2]] ^
+		      crc16_table[0][data[3]];
+		data += 4;
+		length -= 4;
+	}
+
+	while(length--)
+		crc = (crc << 8) ^ crc16_table[0][(crc >> 8) ^ *data++];
+
+	return crc;
+}
+
+guint32 crc32_update(guint32 crc, const guint8 *data, gsize length)
+{
+	crc_init();
+
+	while(length >= 4)
+	{
+		crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+		crc = crc32_table[3][crc & 0xff] ^
+		      crc32_table[2][(crc >> 8) & 0xff] ^
+		      crc32_table[1][(crc >> 16) & 0xff] ^
+		      crc32_table[0][crc >> 24];
+		data += 4;
+		length -= 4;
+	}
+
+	while(length--)
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xff];
+
+	return crc;
+}
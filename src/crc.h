@@ -0,0 +1,21 @@
+/***********************************************************************/
+/* crc.h                                                               */
+/* -----                                                               */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      CRC-16 (XMODEM) and CRC-32 of the file transfer protocols      */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef CRC_H_
+#define CRC_H_
+
+guint16 crc16_update(guint16, const guint8 *, gsize);
+guint32 crc32_update(guint32, const guint8 *, gsize);
+
+#endif
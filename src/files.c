@@ -27,32 +27,58 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
 #include <glib.h>
 
 #include "term_config.h"
 #include "interface.h"
+#include "files.h"
 #include "serial.h"
 #include "buffer.h"
+#include "pacing.h"
+#include "transfer.h"
+#include "hexdecode.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
+#define FILE_CHUNK_MAX (1024 * 1024)
+#define FILE_PROGRESS_PERIOD (G_USEC_PER_SEC / 4)
+#define PACING_TICKS_PER_SECOND 1000  /* at most, when only a rate is set */
+#define PACING_RETRY 1000             /* in us, while the queue is full */
+#define HEX_FILE_BLOCK (64 * 1024)    /* of text read at once */
+#define PASTE_DIRECT_MAX 64           /* bytes: typed keys, sent at once */
+#define PASTE_WINDOW_TIME 1           /* in s: progress window when it takes longer */
+
+/* What the raw send is busy with */
+enum
+{
+	SENDING_NONE, SENDING_FILE, SENDING_PASTE
+};
+
 /* Global variables */
-gint nb_car;
-gint car_written;
-gint current_buffer_position;
-gint bytes_read;
+gsize nb_car;
+gsize car_written;
+static const gchar *file_data = NULL;      /* the file being sent */
+static gboolean file_mapped;
+static gsize chunk_size;
+static gint64 transfer_start;
+static gint64 last_progress;
 GtkAdjustment *adj;
 GtkWidget *ProgressBar;
-gint Fichier;
+static GtkWidget *RateLabel;
+gint Fichier = -1;
 guint callback_handler;
 gchar *fic_defaut = NULL;
-GtkWidget *Window;
+GtkWidget *Window = NULL;
 gboolean waiting_for_char = FALSE;
-gboolean waiting_for_timer = FALSE;
 gboolean input_running = FALSE;
+static gboolean paced = FALSE;
+static gint64 next_deadline;
+static gint sending = SENDING_NONE;
+static gchar line_end = LINE_FEED;         /* for the delays and the wait for a char */
 gchar *str = NULL;
 FILE *Fic;
 
@@ -61,26 +87,228 @@ gint Envoie_fichier(GtkFileChooser *FS);
 gint Sauve_fichier(GtkFileChooser *FS);
 gint close_all(void);
 void ecriture(gpointer data, gint source);
-gboolean timer(gpointer pointer);
 gboolean idle(gpointer pointer);
 void remove_input(void);
 void add_input(void);
 void write_file(const char *, unsigned int);
+static gboolean paced_write(gpointer data);
 
 extern struct configuration_port config;
 
 
+/* The file is sent from a mapping, or from a copy if it cannot be mapped */
+static gboolean map_file(void)
+{
+	struct stat file_stat;
+	gchar *copy;
+	gssize bytes_read;
+	gsize total = 0;
+
+	if(fstat(Fichier, &file_stat) == -1)
+		return FALSE;
+
+	nb_car = file_stat.st_size;
+	file_mapped = FALSE;
+	file_data = NULL;
+
+	if(nb_car == 0)
+		return TRUE;
+
+	file_data = mmap(NULL, nb_car, PROT_READ, MAP_PRIVATE, Fichier, 0);
+	if(file_data != MAP_FAILED)
+	{
+		file_mapped = TRUE;
+		madvise((void *)file_data, nb_car, MADV_SEQUENTIAL);
+		return TRUE;
+	}
+
+	copy = g_try_malloc(nb_car);
+	if(copy == NULL)
+	{
+		file_data = NULL;
+		errno = ENOMEM;
+		return FALSE;
+	}
+
+	while(total < nb_car)
+	{
+		bytes_read = read(Fichier, copy + total, nb_car - total);
+		if(bytes_read <= 0)
+			break;
+		total += bytes_read;
+	}
+	nb_car = total;
+	file_data = copy;
+
+	return TRUE;
+}
+
+/* Decodes the hexadecimal text of the file into the data to send */
+static gboolean decode_hex_file(const gchar *fileName)
+{
+	hex_decoder_t decoder;
+	struct stat file_stat;
+	GByteArray *data;
+	gchar *block, *msg;
+	gssize bytes_read, size;
+
+	if(fstat(Fichier, &file_stat) == -1)
+		return FALSE;
+
+	data = g_byte_array_sized_new(HEX_DECODE_SIZE(file_stat.st_size));
+	block = g_malloc(HEX_FILE_BLOCK);
+	hex_decoder_init(&decoder);
+
+	while((bytes_read = read(Fichier, block, HEX_FILE_BLOCK)) > 0)
+	{
+		size = data->len;
+		g_byte_array_set_size(data, size + HEX_DECODE_SIZE(bytes_read));
+		size = hex_decode(&decoder, block, bytes_read, data->data + size);
+		if(size == -1)
+			break;
+		g_byte_array_set_size(data, data->len - HEX_DECODE_SIZE(bytes_read) + size);
+	}
+	g_free(block);
+
+	if(bytes_read == 0)
+	{
+		size = data->len;
+		g_byte_array_set_size(data, size + 1);
+		size = hex_decode_finish(&decoder, data->data + size);
+		if(size == 0)
+			g_byte_array_set_size(data, data->len - 1);
+	}
+
+	if(bytes_read == -1)
+	{
+		g_byte_array_unref(data);
+		return FALSE;
+	}
+
+	if(size == -1)
+	{
+		msg = g_strdup_printf(_("Invalid hexadecimal data in %s at line %u, column %u\n"),
+		                      fileName, decoder.line, hex_decoder_column(&decoder));
+		show_message(msg, MSG_ERR);
+		g_free(msg);
+		g_byte_array_unref(data);
+		errno = 0;
+		return FALSE;
+	}
+
+	nb_car = data->len;
+	file_mapped = FALSE;
+	file_data = (gchar *)g_byte_array_free(data, FALSE);
+
+	return TRUE;
+}
+
+/* The data is in file_data: sent in chunks, or paced. */
+/* Without a title, there is no progress window         */
+static void start_sending(gint what, const gchar *title)
+{
+	gchar *msg;
+
+	sending = what;
+	if(title != NULL)
+		progress_window_open(title, G_CALLBACK(close_all));
+
+	car_written = 0;
+	chunk_size = BUFFER_EMISSION;
+
+	/* delays and rates are kept by the pacing deadlines */
+	paced = (config.delai != 0 || config.char_delay > 0 || config.send_rate > 0);
+	if(paced && !pacing_start(paced_write))
+	{
+		msg = g_strdup_printf(_("Cannot pace the transfer: %s\n"), strerror(errno));
+		show_message(msg, MSG_ERR);
+		g_free(msg);
+		paced = FALSE;
+		close_all();
+	}
+	else
+		add_input();
+}
+
+static void start_sending_file(const gchar *fileName)
+{
+	gchar *msg;
+
+	g_free(fic_defaut);
+	fic_defaut = g_strdup(fileName);
+	msg = g_strdup_printf(_("%s : transfer in progress..."), fileName);
+	start_sending(SENDING_FILE, msg);
+	g_free(msg);
+}
+
+/* Data in memory, g_malloc()ed, with a progress window titled title */
+/* when it takes more than about PASTE_WINDOW_TIME or is paced        */
+static void start_sending_data(gint what, gchar *data, gsize length, const gchar *title)
+{
+	gboolean pacing;
+
+	file_data = data;
+	file_mapped = FALSE;
+	nb_car = length;
+	Fichier = -1;
+
+	/* about 10 bits per byte on the line */
+	pacing = (config.delai != 0 || config.char_delay > 0 || config.send_rate > 0 || config.car != -1);
+	start_sending(what, (length * 10 >= (gsize)config.vitesse * PASTE_WINDOW_TIME || pacing) ? title : NULL);
+}
+
+/* The batch protocols send several files at once */
+static void send_protocol_changed(GtkComboBox *combo, gpointer chooser)
+{
+	gint protocol = gtk_combo_box_get_active(combo);
+
+	gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(chooser),
+	                                     protocol == TRANSFER_YMODEM || protocol == TRANSFER_ZMODEM);
+}
+
+static GtkWidget *protocol_box_new(GtkWidget *chooser, GtkWidget *combo, GCallback changed)
+{
+	GtkWidget *Box, *Label;
+
+	Box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	Label = gtk_label_new(_("Protocol:"));
+	gtk_box_pack_start(GTK_BOX(Box), Label, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(Box), combo, FALSE, FALSE, 0);
+	g_signal_connect(GTK_WIDGET(combo), "changed", changed, (gpointer)chooser);
+	gtk_widget_show_all(Box);
+
+	return Box;
+}
+
 void send_raw_file(GtkAction *action, gpointer data)
 {
-	GtkWidget *file_select;
+	static gint protocol = TRANSFER_RAW;
+	GtkWidget *file_select, *Combo;
 
-	file_select = gtk_file_chooser_dialog_new(_("Send RAW File"),
+	/* a paste is short, but it has to end first */
+	if(sending != SENDING_NONE)
+	{
+		Put_temp_message(_("Wait for the paste to be sent"), 2000);
+		return;
+	}
+
+	file_select = gtk_file_chooser_dialog_new(_("Send File"),
 	              GTK_WINDOW(Fenetre),
 	              GTK_FILE_CHOOSER_ACTION_OPEN,
 	              GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
 	              GTK_STOCK_OK, GTK_RESPONSE_ACCEPT,
 	              NULL);
 
+	Combo = gtk_combo_box_text_new();
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), _("Raw"));
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "XMODEM");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "XMODEM-1K");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "YMODEM");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "ZMODEM");
+	gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(file_select),
+	                                  protocol_box_new(file_select, Combo, G_CALLBACK(send_protocol_changed)));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), protocol);
+
 	if(fic_defaut != NULL)
 		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(file_select), fic_defaut);
 
@@ -89,6 +317,23 @@ void send_raw_file(GtkAction *action, gpointer data)
 		gchar *fileName;
 		gchar *msg;
 
+		protocol = gtk_combo_box_get_active(GTK_COMBO_BOX(Combo));
+		if(protocol != TRANSFER_RAW)
+		{
+			GSList *fileNames;
+
+			fileNames = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(file_select));
+			if(fileNames != NULL)
+			{
+				g_free(fic_defaut);
+				fic_defaut = g_strdup(fileNames->data);
+				transfer_send(protocol, fileNames);
+			}
+			g_slist_free_full(fileNames, g_free);
+			gtk_widget_destroy(file_select);
+			return;
+		}
+
 		fileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_select));
 
 		if(!g_file_test(fileName, G_FILE_TEST_IS_REGULAR))
@@ -102,42 +347,15 @@ void send_raw_file(GtkAction *action, gpointer data)
 		}
 
 		Fichier = open(fileName, O_RDONLY);
-		if(Fichier != -1)
+		if(Fichier != -1 && !map_file())
 		{
-			GtkWidget *Bouton_annuler, *Box;
-
-			fic_defaut = g_strdup(fileName);
-			msg = g_strdup_printf(_("%s : transfer in progress..."), fileName);
-
-			gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, msg);
-			car_written = 0;
-			current_buffer_position = 0;
-			bytes_read = 0;
-			nb_car = lseek(Fichier, 0L, SEEK_END);
-			lseek(Fichier, 0L, SEEK_SET);
-
-			Window = gtk_dialog_new();
-			gtk_window_set_title(GTK_WINDOW(Window), msg);
+			msg = g_strdup_printf(_("Cannot read file %s: %s\n"), fileName, strerror(errno));
+			show_message(msg, MSG_ERR);
 			g_free(msg);
-			Box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
-			gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(Window))), Box);
-			ProgressBar = gtk_progress_bar_new();
-
-			gtk_box_pack_start(GTK_BOX(Box), ProgressBar, FALSE, FALSE, 5);
-
-			Bouton_annuler = gtk_button_new_with_label(_("Cancel"));
-			g_signal_connect(GTK_WIDGET(Bouton_annuler), "clicked", G_CALLBACK(close_all), NULL);
-
-			gtk_container_add(GTK_CONTAINER(gtk_dialog_get_action_area(GTK_DIALOG(Window))), Bouton_annuler);
-
-			g_signal_connect(GTK_WIDGET(Window), "delete_event", G_CALLBACK(close_all), NULL);
-
-			gtk_window_set_default_size(GTK_WINDOW(Window), 250, 100);
-			gtk_window_set_modal(GTK_WINDOW(Window), TRUE);
-			gtk_widget_show_all(Window);
-
-			add_input();
+			close(Fichier);
 		}
+		else if(Fichier != -1)
+			start_sending_file(fileName);
 		else
 		{
 			msg = g_strdup_printf(_("Cannot read file %s: %s\n"), fileName, strerror(errno));
@@ -149,104 +367,330 @@ void send_raw_file(GtkAction *action, gpointer data)
 	gtk_widget_destroy(file_select);
 }
 
-void ecriture(gpointer data, gint source)
+/* A text of hexadecimal numbers, sent as the bytes they stand for */
+void send_hex_file(GtkAction *action, gpointer data)
 {
-	static gchar buffer[BUFFER_EMISSION];
-	static gchar *current_buffer;
-	static gint bytes_to_write;
-	gint bytes_written;
-	gchar *car;
+	GtkWidget *file_select;
+	gchar *fileName, *msg;
 
-	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gfloat)car_written/(gfloat)nb_car );
+	/* a paste is short, but it has to end first */
+	if(sending != SENDING_NONE)
+	{
+		Put_temp_message(_("Wait for the paste to be sent"), 2000);
+		return;
+	}
 
-	if(car_written < nb_car)
+	file_select = gtk_file_chooser_dialog_new(_("Send Hexadecimal File"),
+	              GTK_WINDOW(Fenetre),
+	              GTK_FILE_CHOOSER_ACTION_OPEN,
+	              GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	              GTK_STOCK_OK, GTK_RESPONSE_ACCEPT,
+	              NULL);
+
+	if(fic_defaut != NULL)
+		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(file_select), fic_defaut);
+
+	if(gtk_dialog_run(GTK_DIALOG(file_select)) != GTK_RESPONSE_ACCEPT)
 	{
-		/* Read the file only if buffer totally sent or if buffer empty */
-		if(current_buffer_position == bytes_read)
-		{
-			bytes_read = read(Fichier, buffer, BUFFER_EMISSION);
+		gtk_widget_destroy(file_select);
+		return;
+	}
 
-			current_buffer_position = 0;
-			current_buffer = buffer;
-			bytes_to_write = bytes_read;
-		}
+	fileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_select));
+	gtk_widget_destroy(file_select);
 
-		if(current_buffer == NULL)
+	Fichier = open(fileName, O_RDONLY);
+	if(Fichier == -1 || !decode_hex_file(fileName))
+	{
+		/* errno is 0 when the message is already shown */
+		if(errno != 0)
 		{
-			/* something went wrong... */
-			g_free(str);
-			str = g_strdup_printf(_("Error sending file\n"));
-			show_message(str, MSG_ERR);
-			close_all();
-			return;
+			msg = g_strdup_printf(_("Cannot read file %s: %s\n"), fileName, strerror(errno));
+			show_message(msg, MSG_ERR);
+			g_free(msg);
 		}
+		if(Fichier != -1)
+			close(Fichier);
+	}
+	else
+		start_sending_file(fileName);
 
-		car = current_buffer;
+	g_free(fileName);
+}
 
-		if(config.delai != 0 || config.car != -1)
-		{
-			/* search for next LF */
-			bytes_to_write = current_buffer_position;
-			while(*car != LINE_FEED && bytes_to_write < bytes_read)
-			{
-				car++;
-				bytes_to_write++;
-			}
-			if(*car == LINE_FEED)
-				bytes_to_write++;
-		}
+/* The progress window of the transfers, raw or with a protocol */
+void progress_window_open(const gchar *title, GCallback cancel)
+{
+	GtkWidget *Bouton_annuler, *Box;
 
-		/* write to serial port */
-		bytes_written = send_serial(current_buffer, bytes_to_write - current_buffer_position);
+	gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, title);
+	transfer_start = g_get_monotonic_time();
+	last_progress = 0;
 
-		if(bytes_written == -1)
-		{
-			/* Problem while writing, stop file transfer */
-			g_free(str);
-			str = g_strdup_printf(_("Error sending file: %s\n"), strerror(errno));
-			show_message(str, MSG_ERR);
-			close_all();
-			return;
-		}
+	Window = gtk_dialog_new();
+	gtk_window_set_title(GTK_WINDOW(Window), title);
+	Box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+	gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(Window))), Box);
+	ProgressBar = gtk_progress_bar_new();
 
-		car_written += bytes_written;
-		current_buffer_position += bytes_written;
-		current_buffer += bytes_written;
+	gtk_box_pack_start(GTK_BOX(Box), ProgressBar, FALSE, FALSE, 5);
 
-		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gfloat)car_written/(gfloat)nb_car );
+	RateLabel = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(Box), RateLabel, FALSE, FALSE, 5);
 
-		if(config.delai != 0 && *car == LINE_FEED)
-		{
-			remove_input();
-			g_timeout_add(config.delai, (GSourceFunc)timer, NULL);
-			waiting_for_timer = TRUE;
-		}
-		else if(config.car != -1 && *car == LINE_FEED)
-		{
-			remove_input();
-			waiting_for_char = TRUE;
-		}
+	Bouton_annuler = gtk_button_new_with_label(_("Cancel"));
+	g_signal_connect(GTK_WIDGET(Bouton_annuler), "clicked", cancel, NULL);
+
+	gtk_container_add(GTK_CONTAINER(gtk_dialog_get_action_area(GTK_DIALOG(Window))), Bouton_annuler);
+
+	g_signal_connect(GTK_WIDGET(Window), "delete_event", cancel, NULL);
+
+	gtk_window_set_default_size(GTK_WINDOW(Window), 250, 100);
+	gtk_window_set_modal(GTK_WINDOW(Window), TRUE);
+	gtk_widget_show_all(Window);
+}
+
+void progress_window_set_title(const gchar *title)
+{
+	gtk_window_set_title(GTK_WINDOW(Window), title);
+	gtk_statusbar_pop(GTK_STATUSBAR(StatusBar), id);
+	gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, title);
+}
+
+/* total is 0 when the size is not known */
+void progress_window_update(gsize done, gsize total, gboolean force)
+{
+	gint64 now = g_get_monotonic_time();
+	gdouble rate;
+	gint left;
+	gchar *msg;
+
+	/* a few times per second is enough, when it is shown */
+	if(Window == NULL || (!force && now - last_progress < FILE_PROGRESS_PERIOD))
+		return;
+	last_progress = now;
+
+	if(total != 0)
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gdouble)MIN(done, total) / total);
+	else if(done != 0)
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(ProgressBar));
+	else if(force)
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), 1.0);
+
+	if(now == transfer_start || done == 0)
+		return;
+
+	rate = (gdouble)done * G_USEC_PER_SEC / (now - transfer_start);
+	if(total != 0)
+	{
+		left = (gint)((total - MIN(done, total)) / rate);
+		msg = g_strdup_printf(_("%.1f KiB/s, %d:%02d left"), rate / 1024, left / 60, left % 60);
 	}
 	else
+		msg = g_strdup_printf(_("%.1f KiB, %.1f KiB/s"), (gdouble)done / 1024, rate / 1024);
+	gtk_label_set_text(GTK_LABEL(RateLabel), msg);
+	g_free(msg);
+}
+
+void progress_window_close(void)
+{
+	gtk_statusbar_pop(GTK_STATUSBAR(StatusBar), id);
+	if(Window != NULL)
+		gtk_widget_destroy(Window);
+	Window = NULL;
+}
+
+static void update_progress(gboolean force)
+{
+	/* what is still in the transmission queue is not sent yet */
+	progress_window_update(car_written - MIN(car_written, serial_tx_queued()), nb_car, force);
+}
+
+static void send_error(void)
+{
+	/* Problem while writing, stop file transfer */
+	g_free(str);
+	str = g_strdup_printf(_("Error sending file: %s\n"), strerror(errno));
+	show_message(str, MSG_ERR);
+	close_all();
+}
+
+void ecriture(gpointer data, gint source)
+{
+	const gchar *start, *car;
+	gsize bytes_to_write, queued;
+	gint bytes_written;
+
+	/* the previous chunk is not sent yet */
+	if(serial_tx_queued() > 0)
+	{
+		update_progress(FALSE);
+		return;
+	}
+
+	if(car_written == nb_car)
 	{
+		update_progress(TRUE);
 		close_all();
 		return;
 	}
-	return;
+
+	start = file_data + car_written;
+	bytes_to_write = MIN(nb_car - car_written, chunk_size);
+	car = NULL;
+
+	if(config.car != -1)
+	{
+		/* up to the next end of line */
+		car = memchr(start, line_end, bytes_to_write);
+		if(car != NULL)
+			bytes_to_write = car - start + 1;
+	}
+
+	/* write to serial port */
+	bytes_written = send_serial((gchar *)start, bytes_to_write);
+
+	if(bytes_written == -1)
+	{
+		send_error();
+		return;
+	}
+
+	/* the transmission queue is full, try again later */
+	if(bytes_written == 0)
+		return;
+
+	car_written += bytes_written;
+
+	/* larger chunks while the driver takes them at once */
+	queued = serial_tx_queued();
+	if(queued == 0)
+		chunk_size = MIN(chunk_size * 2, FILE_CHUNK_MAX);
+	else if(queued > chunk_size / 2)
+		chunk_size = MAX(chunk_size / 2, BUFFER_EMISSION);
+
+	update_progress(FALSE);
+
+	if(car != NULL && bytes_written == (gint)bytes_to_write)
+	{
+		remove_input();
+		waiting_for_char = TRUE;
+	}
 }
 
-gboolean timer(gpointer pointer)
+/* Called at each deadline of a paced transfer: sends what is due and */
+/* sets the next deadline from the one just met, not from the current */
+/* time, so that the rate holds over the whole file                   */
+static gboolean paced_write(gpointer data)
 {
-	if(waiting_for_timer == TRUE)
+	const gchar *start, *car;
+	gsize bytes_to_write;
+	gint bytes_written;
+	gint64 now, period = 0;
+
+	now = g_get_monotonic_time();
+
+	if(car_written == nb_car)
 	{
-		add_input();
-		waiting_for_timer = FALSE;
+		if(serial_tx_queued() > 0)
+		{
+			pacing_schedule(now + PACING_RETRY);
+			return TRUE;
+		}
+		update_progress(TRUE);
+		close_all();
+		return FALSE;
 	}
-	return FALSE;
+
+	start = file_data + car_written;
+
+	if(config.char_delay > 0)
+		bytes_to_write = 1;
+	else if(config.send_rate > 0)
+		bytes_to_write = MAX(config.send_rate / PACING_TICKS_PER_SECOND, 1);
+	else
+		bytes_to_write = chunk_size;
+	bytes_to_write = MIN(bytes_to_write, nb_car - car_written);
+
+	car = NULL;
+	if(config.delai != 0 || config.car != -1)
+	{
+		car = memchr(start, line_end, bytes_to_write);
+		if(car != NULL)
+			bytes_to_write = car - start + 1;
+	}
+
+	bytes_written = send_serial((gchar *)start, bytes_to_write);
+
+	if(bytes_written == -1)
+	{
+		send_error();
+		return FALSE;
+	}
+
+	car_written += bytes_written;
+	update_progress(FALSE);
+
+	/* the transmission queue is full, try again later */
+	if(bytes_written == 0)
+	{
+		next_deadline = now + PACING_RETRY;
+		pacing_schedule(next_deadline);
+		return TRUE;
+	}
+
+	if(config.char_delay > 0)
+		period += (gint64)bytes_written * config.char_delay;
+	if(config.send_rate > 0)
+		period += (gint64)bytes_written * G_USEC_PER_SEC / config.send_rate;
+
+	if(car != NULL && bytes_written == (gint)bytes_to_write)
+	{
+		if(config.car != -1)
+		{
+			/* add_input() sets the next deadline when the char comes */
+			waiting_for_char = TRUE;
+			return TRUE;
+		}
+		period += (gint64)config.delai * 1000;
+	}
+
+	next_deadline += period;
+
+	/* do not send a burst to catch up after a long stall */
+	if(now - next_deadline > PACING_MAX_LATE)
+		next_deadline = now;
+
+	pacing_schedule(next_deadline);
+
+	return TRUE;
+}
+
+static void report_jitter(const gchar *what)
+{
+	pacing_stats_t stats;
+	gchar *msg;
+
+	pacing_get_statistics(&stats);
+	if(stats.ticks == 0)
+		return;
+
+	msg = g_strdup_printf(_("%s in %.3f s, pacing jitter: %.1f us average, %" G_GINT64_FORMAT " us max"), what,
+	                      (gdouble)(stats.end - stats.start) / G_USEC_PER_SEC,
+	                      (gdouble)stats.total_late / stats.ticks, stats.max_late);
+	Put_temp_message(msg, 10000);
+	g_free(msg);
 }
 
 void add_input(void)
 {
+	if(paced)
+	{
+		next_deadline = g_get_monotonic_time();
+		pacing_schedule(next_deadline);
+		return;
+	}
+
 	if(input_running == FALSE)
 	{
 		input_running = TRUE;
@@ -271,15 +715,117 @@ void remove_input(void)
 gint close_all(void)
 {
 	remove_input();
+	if(paced)
+	{
+		pacing_stop();
+		if(car_written == nb_car)
+			report_jitter(sending == SENDING_PASTE ? _("Text pasted") : _("File sent"));
+		paced = FALSE;
+	}
+	sending = SENDING_NONE;
+	line_end = LINE_FEED;
 	waiting_for_char = FALSE;
-	waiting_for_timer = FALSE;
-	gtk_statusbar_pop(GTK_STATUSBAR(StatusBar), id);
-	close(Fichier);
-	gtk_widget_destroy(Window);
+	if(file_mapped)
+		munmap((void *)file_data, nb_car);
+	else
+		g_free((gchar *)file_data);
+	file_data = NULL;
+	file_mapped = FALSE;
+	if(Fichier != -1)
+		close(Fichier);
+	Fichier = -1;
+	if(Window != NULL)
+		progress_window_close();
 
 	return FALSE;
 }
 
+/* Pasted text, from the commit of the terminal: more than a few */
+/* bytes go through the raw send, in chunks through the transmit */
+/* queue, with the delays of the file transfers and a progress   */
+/* window when it takes time. The terminal pastes lines ending   */
+/* with a CR                                                     */
+void send_paste(const gchar *text, gsize length)
+{
+	gchar *data;
+
+	/* typed while a paste is sent: after it */
+	if(sending == SENDING_PASTE)
+	{
+		file_data = g_realloc((gchar *)file_data, nb_car + length);
+		memcpy((gchar *)file_data + nb_car, text, length);
+		nb_car += length;
+		return;
+	}
+
+	if(sending == SENDING_FILE || length <= PASTE_DIRECT_MAX)
+	{
+		send_serial((gchar *)text, length);
+		return;
+	}
+
+	data = g_malloc(length);
+	memcpy(data, text, length);
+	line_end = CARRIAGE_RETURN;
+	start_sending_data(SENDING_PASTE, data, length, _("Pasting..."));
+}
+
+/* Data typed in hexadecimal, g_malloc()ed: it belongs to the send once */
+/* it has started. FALSE when another send has to end first             */
+gboolean send_hexadecimal_data(guint8 *data, gsize length)
+{
+	if(sending != SENDING_NONE)
+		return FALSE;
+
+	start_sending_data(SENDING_FILE, (gchar *)data, length, _("Sending hexadecimal data..."));
+
+	return TRUE;
+}
+
+/* XMODEM does not carry the names: a file is chosen instead of a folder */
+static void receive_protocol_changed(GtkComboBox *combo, gpointer chooser)
+{
+	if(gtk_combo_box_get_active(combo) == 0)
+		gtk_file_chooser_set_action(GTK_FILE_CHOOSER(chooser), GTK_FILE_CHOOSER_ACTION_SAVE);
+	else
+		gtk_file_chooser_set_action(GTK_FILE_CHOOSER(chooser), GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+}
+
+void receive_file(GtkAction *action, gpointer data)
+{
+	static gint protocol = 2;
+	const gint protocols[] = {TRANSFER_XMODEM, TRANSFER_YMODEM, TRANSFER_ZMODEM};
+	GtkWidget *file_select, *Combo;
+
+	file_select = gtk_file_chooser_dialog_new(_("Receive File"),
+	              GTK_WINDOW(Fenetre),
+	              GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+	              GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	              GTK_STOCK_OK, GTK_RESPONSE_ACCEPT,
+	              NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(file_select), TRUE);
+
+	Combo = gtk_combo_box_text_new();
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "XMODEM");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "YMODEM");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "ZMODEM");
+	gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(file_select),
+	                                  protocol_box_new(file_select, Combo, G_CALLBACK(receive_protocol_changed)));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), protocol);
+
+	if(gtk_dialog_run(GTK_DIALOG(file_select)) == GTK_RESPONSE_ACCEPT)
+	{
+		gchar *fileName;
+
+		protocol = gtk_combo_box_get_active(GTK_COMBO_BOX(Combo));
+		fileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_select));
+		if(fileName != NULL)
+			transfer_receive(protocols[protocol], fileName);
+		g_free(fileName);
+	}
+	gtk_widget_destroy(file_select);
+}
+
 void write_file(const char *data, unsigned int size)
 {
 	fwrite(data, size, 1, Fic);
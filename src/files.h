@@ -16,9 +16,17 @@
 #define FICHIER_H_
 
 void send_raw_file(GtkAction *action, gpointer data);
+void send_hex_file(GtkAction *action, gpointer data);
 void save_raw_file(GtkAction *action, gpointer data);
 void save_ascii_file(GtkAction *action, gpointer data);
+void receive_file(GtkAction *action, gpointer data);
 void add_input(void);
+void send_paste(const gchar *, gsize);
+gboolean send_hexadecimal_data(guint8 *, gsize);
+void progress_window_open(const gchar *, GCallback);
+void progress_window_set_title(const gchar *);
+void progress_window_update(gsize, gsize, gboolean);
+void progress_window_close(void);
 
 extern gboolean waiting_for_char;
 extern gchar *fic_defaut;
@@ -30,6 +30,7 @@
 #include "auto_config.h"
 #include "device_monitor.h"
 #include "user_signals.h"
+#include "logging.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
@@ -73,6 +74,8 @@ int main(int argc, char *argv[])
 
 	gtk_main();
 
+	logging_close();
+
 	delete_buffer();
 
 	Close_port();
@@ -0,0 +1,148 @@
+/***********************************************************************/
+/* hexdecode.c                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Streaming decoder of hexadecimal text                          */
+/*                                                                     */
+/*      Numbers are separated by blanks, new lines, ',' or ';' and     */
+/*      can start with "0x". A number is a single digit, or pairs of   */
+/*      digits, one byte per pair: "0A 1 0x0D0a,ff" gives 0A 01 0D 0A  */
+/*      FF. The text can be fed in pieces of any size, a number can    */
+/*      be cut between two of them.                                    */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+
+#include "hexdecode.h"
+
+enum
+{
+	CLASS_SEPARATOR = 16,   /* below: value of the digit */
+	CLASS_X,
+	CLASS_INVALID
+};
+
+static guint8 classes[256];
+
+static void init_classes(void)
+{
+	static gsize initialized = 0;
+	const gchar *separators = " \t\r\n\v\f,;";
+	guint c;
+
+	if(!g_once_init_enter(&initialized))
+		return;
+
+	for(c = 0; c < 256; c++)
+	{
+		if(g_ascii_isxdigit(c))
+			classes[c] = g_ascii_xdigit_value(c);
+		else
+			classes[c] = CLASS_INVALID;
+	}
+	for(; *separators != 0; separators++)
+		classes[(guint8)*separators] = CLASS_SEPARATOR;
+	classes['x'] = CLASS_X;
+	classes['X'] = CLASS_X;
+
+	g_once_init_leave(&initialized, 1);
+}
+
+void hex_decoder_init(hex_decoder_t *decoder)
+{
+	init_classes();
+
+	decoder->nibble = 0;
+	decoder->digits = 0;
+	decoder->prefix = FALSE;
+	decoder->position = 0;
+	decoder->token_start = 0;
+	decoder->line = 1;
+	decoder->line_start = 0;
+	decoder->error = 0;
+}
+
+/* At the end of a number: the byte of a single digit, or an error */
+static gboolean end_number(hex_decoder_t *decoder, guint8 *out, gsize *size)
+{
+	if(decoder->digits == 1)
+		out[(*size)++] = decoder->nibble;
+	else if(decoder->digits % 2 == 1 || (decoder->prefix && decoder->digits == 0))
+	{
+		decoder->error = decoder->token_start;
+		return FALSE;
+	}
+
+	decoder->digits = 0;
+	decoder->prefix = FALSE;
+	return TRUE;
+}
+
+/* Returns the bytes written to out, HEX_DECODE_SIZE(length) at most, */
+/* or -1 with the position of the malformed char in decoder->error    */
+gssize hex_decode(hex_decoder_t *decoder, const gchar *text, gsize length, guint8 *out)
+{
+	gsize i, size = 0;
+	guint8 class;
+
+	for(i = 0; i < length; i++, decoder->position++)
+	{
+		class = classes[(guint8)text[i]];
+
+		if(class < CLASS_SEPARATOR)
+		{
+			if(decoder->digits == 0 && !decoder->prefix)
+				decoder->token_start = decoder->position;
+			if(decoder->digits % 2 == 0)
+				decoder->nibble = class;
+			else
+				out[size++] = (decoder->nibble << 4) | class;
+			decoder->digits++;
+		}
+		else if(class == CLASS_SEPARATOR)
+		{
+			if(!end_number(decoder, out, &size))
+				return -1;
+			if(text[i] == '\n')
+			{
+				decoder->line++;
+				decoder->line_start = decoder->position + 1;
+			}
+		}
+		else if(class == CLASS_X && decoder->digits == 1 && decoder->nibble == 0 && !decoder->prefix)
+		{
+			decoder->digits = 0;
+			decoder->prefix = TRUE;
+		}
+		else
+		{
+			decoder->error = decoder->position;
+			return -1;
+		}
+	}
+
+	return size;
+}
+
+/* At the end of the text: the last number, 1 byte at most, or -1 */
+gssize hex_decode_finish(hex_decoder_t *decoder, guint8 *out)
+{
+	gsize size = 0;
+
+	if(!end_number(decoder, out, &size))
+		return -1;
+
+	return size;
+}
+
+/* Of the error, from 1, in bytes */
+guint hex_decoder_column(hex_decoder_t *decoder)
+{
+	return decoder->error - MIN(decoder->line_start, decoder->error) + 1;
+}
@@ -0,0 +1,39 @@
+/***********************************************************************/
+/* hexdecode.h                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Streaming decoder of hexadecimal text                          */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef HEXDECODE_H_
+#define HEXDECODE_H_
+
+typedef struct
+{
+	guint8 nibble;        /* first digit of a pair */
+	guint digits;         /* in the current number */
+	gboolean prefix;      /* "0x" was read */
+	gsize position;       /* of the next char, from the start */
+	gsize token_start;
+	guint line;           /* from 1 */
+	gsize line_start;
+	gsize error;          /* first malformed char */
+}
+hex_decoder_t;
+
+/* Enough room in the output for any input */
+#define HEX_DECODE_SIZE(length) ((length) / 2 + 1)
+
+void hex_decoder_init(hex_decoder_t *);
+gssize hex_decode(hex_decoder_t *, const gchar *, gsize, guint8 *);
+gssize hex_decode_finish(hex_decoder_t *, guint8 *);
+guint hex_decoder_column(hex_decoder_t *);
+
+#endif
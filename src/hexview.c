@@ -0,0 +1,532 @@
+/***********************************************************************/
+/* hexview.c                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal view drawn straight from the received data buffer  */
+/*                                                                     */
+/*      Nothing is formatted in advance: only the rows which are       */
+/*      visible are read from the buffer and drawn, so the cost does   */
+/*      not depend on the size of the history. Rows and the selection  */
+/*      are addressed by byte offset since the last clear.             */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <string.h>
+
+#include "term_config.h"
+#include "buffer.h"
+#include "hexview.h"
+
+#define HEXVIEW_MAX_BYTES_PER_LINE 32
+#define HEXVIEW_MAX_COPY (16 * 1024 * 1024)
+#define HEXVIEW_SCROLL_ROWS 3
+
+static GtkWidget *box = NULL;
+static GtkWidget *area;
+static GtkAdjustment *adjustment;
+static guint tick_id = 0;
+
+static gint bytes_per_line = 16;
+static gboolean show_index = FALSE;
+/* first row of the buffer when the adjustment was last updated */
+static guint64 shown_first_row = 0;
+
+static PangoFontDescription *font = NULL;
+static gchar *font_name = NULL;
+static gint char_width = 8;
+static gint line_height = 16;
+
+/* selection, as offsets of bytes received since the last clear */
+static gboolean selecting = FALSE;
+static gint64 selection_anchor = -1;
+static gint64 selection_end = -1;
+static void (*selection_func)(void) = NULL;
+
+static gchar hex_digits[256][2];
+static gchar hex_printable[256];
+
+extern display_config_t term_conf;
+
+static void update_font(void)
+{
+	PangoFontMetrics *metrics;
+
+	if(font != NULL && g_strcmp0(font_name, term_conf.font) == 0)
+		return;
+
+	if(font != NULL)
+		pango_font_description_free(font);
+	g_free(font_name);
+
+	font_name = g_strdup(term_conf.font);
+	font = pango_font_description_from_string(font_name != NULL ? font_name : DEFAULT_FONT);
+
+	metrics = pango_context_get_metrics(gtk_widget_get_pango_context(area), font, NULL);
+	char_width = MAX(1, pango_font_metrics_get_approximate_digit_width(metrics) / PANGO_SCALE);
+	line_height = MAX(1, (pango_font_metrics_get_ascent(metrics) +
+	                      pango_font_metrics_get_descent(metrics)) / PANGO_SCALE);
+	pango_font_metrics_unref(metrics);
+}
+
+static gint index_columns(void)
+{
+	return show_index ? 10 : 0;
+}
+
+static gint hex_column(gint i)
+{
+	return index_columns() + 3 * i + (i > bytes_per_line / 2 - 1 ? 2 : 0);
+}
+
+static gint ascii_column(gint i)
+{
+	return index_columns() + 3 * bytes_per_line + 2 + 3 + i;
+}
+
+static void get_rows(guint64 *first_row, guint64 *rows)
+{
+	guint64 used, resident, size, start;
+
+	get_buffer_usage(&used, &resident, &size);
+	start = get_buffer_start_offset();
+
+	*first_row = start / bytes_per_line;
+	*rows = used ? (start + used - 1) / bytes_per_line - *first_row + 1 : 0;
+}
+
+static void update_adjustment(void)
+{
+	guint64 first_row, rows;
+	gdouble value, page;
+	gboolean at_bottom;
+
+	get_rows(&first_row, &rows);
+
+	page = MAX(1, gtk_widget_get_allocated_height(area) / line_height);
+	value = gtk_adjustment_get_value(adjustment);
+	at_bottom = value + gtk_adjustment_get_page_size(adjustment) >= gtk_adjustment_get_upper(adjustment);
+
+	/* keep showing the same bytes when the oldest ones are overwritten */
+	if(first_row >= shown_first_row)
+		value -= first_row - shown_first_row;
+	else
+		value = 0;
+	shown_first_row = first_row;
+
+	if(at_bottom)
+		value = rows - page;
+
+	gtk_adjustment_configure(adjustment,
+	                         CLAMP(value, 0, MAX(rows - page, 0)),
+	                         0, rows, 1, MAX(page - 1, 1), page);
+}
+
+static void format_row(GString *text, const guchar *bytes, gint first, gint count, guint64 offset)
+{
+	gint i;
+
+	g_string_truncate(text, 0);
+
+	if(show_index)
+		g_string_append_printf(text, "%8" G_GUINT64_FORMAT ": ", offset);
+
+	for(i = 0; i < bytes_per_line; i++)
+	{
+		if(i >= first && i < count)
+		{
+			g_string_append_len(text, hex_digits[bytes[i]], 2);
+			g_string_append_c(text, ' ');
+		}
+		else
+			g_string_append_len(text, "   ", 3);
+
+		if(i == bytes_per_line / 2 - 1)
+			g_string_append_len(text, "- ", 2);
+	}
+
+	g_string_append_len(text, "   ", 3);
+
+	for(i = 0; i < count; i++)
+		g_string_append_c(text, i >= first ? hex_printable[bytes[i]] : ' ');
+}
+
+static void draw_selection(cairo_t *cr, guint64 offset, gint first, gint count, gint y)
+{
+	gint64 low, high;
+	gint i;
+
+	if(selection_anchor < 0)
+		return;
+
+	low = MIN(selection_anchor, selection_end);
+	high = MAX(selection_anchor, selection_end);
+
+	for(i = first; i < count; i++)
+	{
+		if((gint64)offset + i < low || (gint64)offset + i > high)
+			continue;
+
+		cairo_rectangle(cr, hex_column(i) * char_width, y, 2 * char_width, line_height);
+		cairo_rectangle(cr, ascii_column(i) * char_width, y, char_width, line_height);
+	}
+
+	cairo_set_source_rgba(cr, term_conf.foreground_color.red,
+	                      term_conf.foreground_color.green,
+	                      term_conf.foreground_color.blue, 0.3);
+	cairo_fill(cr);
+}
+
+static gboolean hexview_draw(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+	guint64 used, resident, size, start, row, offset;
+	guchar bytes[HEXVIEW_MAX_BYTES_PER_LINE];
+	PangoLayout *layout;
+	GString *text;
+	gint y, height, first, count;
+
+	update_font();
+
+	gdk_cairo_set_source_rgba(cr, &term_conf.background_color);
+	cairo_paint(cr);
+
+	get_buffer_usage(&used, &resident, &size);
+	if(used == 0)
+		return TRUE;
+
+	start = get_buffer_start_offset();
+	height = gtk_widget_get_allocated_height(widget);
+	row = start / bytes_per_line + (guint64)gtk_adjustment_get_value(adjustment);
+
+	layout = gtk_widget_create_pango_layout(widget, NULL);
+	pango_layout_set_font_description(layout, font);
+	text = g_string_sized_new(ascii_column(bytes_per_line) + 1);
+
+	/* only the visible rows are read from the buffer */
+	for(y = 0; y < height && row * bytes_per_line < start + used; y += line_height, row++)
+	{
+		offset = row * bytes_per_line;
+		first = offset < start ? start - offset : 0;
+		count = first + read_buffer(offset + first - start, (char *)bytes + first,
+		                            bytes_per_line - first);
+
+		draw_selection(cr, offset, first, count, y);
+
+		format_row(text, bytes, first, count, offset);
+		pango_layout_set_text(layout, text->str, text->len);
+		gdk_cairo_set_source_rgba(cr, &term_conf.foreground_color);
+		cairo_move_to(cr, 0, y);
+		pango_cairo_show_layout(cr, layout);
+	}
+
+	g_string_free(text, TRUE);
+	g_object_unref(layout);
+
+	return TRUE;
+}
+
+static gint64 byte_at(gdouble x, gdouble y)
+{
+	guint64 used, resident, size, start, row;
+	gint column, i;
+	gint64 offset;
+
+	get_buffer_usage(&used, &resident, &size);
+	if(used == 0)
+		return -1;
+	start = get_buffer_start_offset();
+
+	row = start / bytes_per_line + (guint64)gtk_adjustment_get_value(adjustment) + MAX(y, 0) / line_height;
+	column = MAX(x, 0) / char_width;
+
+	if(column >= ascii_column(0))
+		i = column - ascii_column(0);
+	else
+	{
+		column -= index_columns();
+		if(column >= hex_column(bytes_per_line / 2) - index_columns())
+			column -= 2;
+		i = MAX(column, 0) / 3;
+	}
+	i = CLAMP(i, 0, bytes_per_line - 1);
+
+	offset = row * bytes_per_line + i;
+	return CLAMP(offset, (gint64)start, (gint64)(start + used - 1));
+}
+
+static void selection_changed(void)
+{
+	gtk_widget_queue_draw(area);
+	if(selection_func != NULL)
+		selection_func();
+}
+
+static gboolean hexview_button_press(GtkWidget *widget, GdkEventButton *event, gpointer data)
+{
+	if(event->type != GDK_BUTTON_PRESS || event->button != 1)
+		return FALSE;
+
+	gtk_widget_grab_focus(area);
+
+	selecting = TRUE;
+	selection_anchor = byte_at(event->x, event->y);
+	selection_end = selection_anchor;
+	selection_changed();
+
+	return TRUE;
+}
+
+static gboolean hexview_motion(GtkWidget *widget, GdkEventMotion *event, gpointer data)
+{
+	if(!selecting || selection_anchor < 0)
+		return FALSE;
+
+	selection_end = byte_at(event->x, event->y);
+	gtk_widget_queue_draw(area);
+
+	return TRUE;
+}
+
+static gboolean hexview_button_release(GtkWidget *widget, GdkEventButton *event, gpointer data)
+{
+	if(event->button != 1 || !selecting)
+		return FALSE;
+
+	selecting = FALSE;
+	selection_changed();
+
+	return TRUE;
+}
+
+static gboolean hexview_scroll(GtkWidget *widget, GdkEventScroll *event, gpointer data)
+{
+	gdouble value, dx, dy;
+
+	value = gtk_adjustment_get_value(adjustment);
+
+	switch(event->direction)
+	{
+	case GDK_SCROLL_UP:
+		value -= HEXVIEW_SCROLL_ROWS;
+		break;
+	case GDK_SCROLL_DOWN:
+		value += HEXVIEW_SCROLL_ROWS;
+		break;
+	case GDK_SCROLL_SMOOTH:
+		gdk_event_get_scroll_deltas((GdkEvent *)event, &dx, &dy);
+		value += dy * HEXVIEW_SCROLL_ROWS;
+		break;
+	default:
+		return FALSE;
+	}
+
+	gtk_adjustment_set_value(adjustment, value);
+	return TRUE;
+}
+
+static gboolean hexview_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data)
+{
+	gdouble value, page;
+
+	value = gtk_adjustment_get_value(adjustment);
+	page = gtk_adjustment_get_page_increment(adjustment);
+
+	/* other keys are sent to the serial port by the parent */
+	switch(event->keyval)
+	{
+	case GDK_KEY_Page_Up:
+		value -= page;
+		break;
+	case GDK_KEY_Page_Down:
+		value += page;
+		break;
+	case GDK_KEY_Home:
+		if(!(event->state & GDK_CONTROL_MASK))
+			return FALSE;
+		value = 0;
+		break;
+	case GDK_KEY_End:
+		if(!(event->state & GDK_CONTROL_MASK))
+			return FALSE;
+		value = gtk_adjustment_get_upper(adjustment);
+		break;
+	default:
+		return FALSE;
+	}
+
+	gtk_adjustment_set_value(adjustment, value);
+	return TRUE;
+}
+
+static void hexview_size_allocate(GtkWidget *widget, GdkRectangle *allocation, gpointer data)
+{
+	update_adjustment();
+}
+
+static void hexview_value_changed(GtkAdjustment *adj, gpointer data)
+{
+	gtk_widget_queue_draw(area);
+}
+
+static gboolean hexview_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data)
+{
+	update_adjustment();
+	gtk_widget_queue_draw(area);
+	tick_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+GtkWidget *hexview_new(void)
+{
+	static const gchar digits[] = "0123456789ABCDEF";
+	GtkWidget *scrollbar;
+	gint i;
+
+	for(i = 0; i < 256; i++)
+	{
+		hex_digits[i][0] = digits[i >> 4];
+		hex_digits[i][1] = digits[i & 0x0F];
+		hex_printable[i] = (i > 0x1F && i < 0x7F) ? i : '.';
+	}
+
+	box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+
+	area = gtk_drawing_area_new();
+	gtk_widget_set_can_focus(area, TRUE);
+	gtk_widget_add_events(area, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK |
+	                      GDK_BUTTON1_MOTION_MASK | GDK_SCROLL_MASK |
+	                      GDK_SMOOTH_SCROLL_MASK | GDK_KEY_PRESS_MASK);
+	gtk_box_pack_start(GTK_BOX(box), area, TRUE, TRUE, 0);
+
+	adjustment = gtk_adjustment_new(0, 0, 0, 1, 1, 1);
+	scrollbar = gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, adjustment);
+	gtk_box_pack_start(GTK_BOX(box), scrollbar, FALSE, FALSE, 0);
+
+	g_signal_connect(G_OBJECT(area), "draw", G_CALLBACK(hexview_draw), NULL);
+	g_signal_connect(G_OBJECT(area), "button-press-event", G_CALLBACK(hexview_button_press), NULL);
+	g_signal_connect(G_OBJECT(area), "motion-notify-event", G_CALLBACK(hexview_motion), NULL);
+	g_signal_connect(G_OBJECT(area), "button-release-event", G_CALLBACK(hexview_button_release), NULL);
+	g_signal_connect(G_OBJECT(area), "scroll-event", G_CALLBACK(hexview_scroll), NULL);
+	g_signal_connect(G_OBJECT(area), "key-press-event", G_CALLBACK(hexview_key_press), NULL);
+	g_signal_connect(G_OBJECT(area), "size-allocate", G_CALLBACK(hexview_size_allocate), NULL);
+	g_signal_connect(G_OBJECT(adjustment), "value-changed", G_CALLBACK(hexview_value_changed), NULL);
+
+	update_font();
+
+	return box;
+}
+
+void hexview_set_format(gint bytes, gboolean index)
+{
+	guint64 rows;
+	gdouble page;
+
+	bytes_per_line = CLAMP(bytes, 2, HEXVIEW_MAX_BYTES_PER_LINE);
+	show_index = index;
+
+	if(box == NULL)
+		return;
+
+	/* the rows have changed: show the most recent ones */
+	get_rows(&shown_first_row, &rows);
+	page = gtk_adjustment_get_page_size(adjustment);
+	gtk_adjustment_configure(adjustment, MAX(rows - page, 0), 0, rows,
+	                         1, MAX(page - 1, 1), page);
+	gtk_widget_queue_draw(area);
+}
+
+/* New data: the view is updated once per frame at most */
+void hexview_data_changed(void)
+{
+	if(box == NULL || tick_id != 0)
+		return;
+
+	tick_id = gtk_widget_add_tick_callback(area, hexview_tick, NULL, NULL);
+}
+
+void hexview_clear(void)
+{
+	if(box == NULL)
+		return;
+
+	selecting = FALSE;
+	selection_anchor = -1;
+	selection_end = -1;
+	shown_first_row = 0;
+	gtk_adjustment_set_value(adjustment, 0);
+
+	hexview_data_changed();
+	if(selection_func != NULL)
+		selection_func();
+}
+
+gboolean hexview_has_selection(void)
+{
+	return selection_anchor >= 0;
+}
+
+void hexview_select_all(void)
+{
+	guint64 used, resident, size, start;
+
+	get_buffer_usage(&used, &resident, &size);
+	if(used == 0)
+		return;
+
+	start = get_buffer_start_offset();
+	selection_anchor = start;
+	selection_end = start + used - 1;
+	selection_changed();
+}
+
+void hexview_copy_clipboard(void)
+{
+	guint64 start, low, high, length, done;
+	guchar bytes[HEXVIEW_MAX_BYTES_PER_LINE];
+	GString *text;
+	guint count, i;
+
+	if(selection_anchor < 0)
+		return;
+
+	/* the oldest selected bytes may have been overwritten since */
+	start = get_buffer_start_offset();
+	low = MAX((guint64)MIN(selection_anchor, selection_end), start);
+	high = MAX(selection_anchor, selection_end);
+	if(high < low)
+		return;
+
+	length = MIN(high - low + 1, HEXVIEW_MAX_COPY);
+	text = g_string_sized_new(length * 3);
+
+	for(done = 0; done < length; done += count)
+	{
+		count = read_buffer(low + done - start, (char *)bytes, MIN(length - done, sizeof(bytes)));
+		if(count == 0)
+			break;
+
+		for(i = 0; i < count; i++)
+		{
+			g_string_append_len(text, hex_digits[bytes[i]], 2);
+			g_string_append_c(text, ' ');
+		}
+	}
+
+	if(text->len > 0)
+		g_string_truncate(text, text->len - 1);
+
+	gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), text->str, text->len);
+	g_string_free(text, TRUE);
+}
+
+void hexview_set_selection_func(void (*func)(void))
+{
+	selection_func = func;
+}
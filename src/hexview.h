@@ -0,0 +1,27 @@
+/***********************************************************************/
+/* hexview.h                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal view drawn straight from the received data buffer  */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef HEXVIEW_H_
+#define HEXVIEW_H_
+
+GtkWidget *hexview_new(void);
+void hexview_set_format(gint, gboolean);
+void hexview_data_changed(void);
+void hexview_clear(void);
+gboolean hexview_has_selection(void);
+void hexview_select_all(void);
+void hexview_copy_clipboard(void);
+void hexview_set_selection_func(void (*func)(void));
+
+#endif
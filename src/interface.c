@@ -78,6 +78,13 @@
 #include "auto_config.h"
 #include "logging.h"
 #include "device_monitor.h"
+#include "rx_thread.h"
+#include "render.h"
+#include "hexview.h"
+#include "latency.h"
+#include "pacing.h"
+#include "transfer.h"
+#include "hexdecode.h"
 
 #include <config.h>
 #include <glib/gprintf.h>
@@ -91,6 +98,8 @@ gboolean esc_clear_screen_on;
 gboolean timestamp_on = 0;
 GtkWidget *StatusBar;
 GtkWidget *signals[6];
+static GtkWidget *buffer_usage_label;
+static GtkWidget *tx_queue_label;
 static GtkWidget *Hex_Box;
 GtkWidget *searchBar;
 GtkWidget *scrolled_window;
@@ -106,16 +115,18 @@ GtkTextBuffer *buffer;
 GtkTextIter iter;
 
 extern struct configuration_port config;
+extern display_config_t term_conf;
 
 /* Variables for hexadecimal display */
 static gint bytes_per_line = 16;
-static gchar blank_data[128];
-static guint total_bytes;
 static gboolean show_index = FALSE;
-guint virt_col_pos = 0;
+static GtkWidget *hex_view;
+static gchar hex_digits[256][2];
+static GString *hex_log = NULL;
 
 /* Local functions prototype */
 void signals_send_break_callback(GtkAction *action, gpointer data);
+void signals_latency_test_callback(GtkAction *action, gpointer data);
 void signals_toggle_DTR_callback(GtkAction *action, gpointer data);
 void signals_toggle_RTS_callback(GtkAction *action, gpointer data);
 void signals_close_port(GtkAction *action, gpointer data);
@@ -123,6 +134,8 @@ void signals_open_port(GtkAction *action, gpointer data);
 void help_about_callback(GtkAction *action, gpointer data);
 gboolean Envoie_car(GtkWidget *, GdkEventKey *, gpointer);
 gboolean control_signals_read(void);
+gboolean buffer_usage_update(void);
+gboolean tx_queue_update(void);
 void echo_toggled_callback(GtkAction *action, gpointer data);
 void Autoreconnect_toggled_callback(GtkAction *action, gpointer data);
 void CR_LF_auto_toggled_callback(GtkAction *action, gpointer data);
@@ -132,6 +145,7 @@ void view_radio_callback(GtkAction *action, gpointer data);
 void view_hexadecimal_chars_radio_callback(GtkAction* action, gpointer data);
 void view_index_toggled_callback(GtkAction *action, gpointer data);
 void view_send_hex_toggled_callback(GtkAction *action, gpointer data);
+void view_statistics_callback(GtkAction *action, gpointer data);
 void initialize_hexadecimal_display(void);
 gboolean Send_Hexadecimal(GtkWidget *, GdkEventKey *, gpointer);
 gboolean pop_message(void);
@@ -160,7 +174,9 @@ const GtkActionEntry menu_entries[] =
 	{"FileExit", GTK_STOCK_QUIT, NULL, "<shift><control>Q", NULL, gtk_main_quit},
 	{"ClearScreen", GTK_STOCK_CLEAR, N_("_Clear screen"), "<shift><control>L", NULL, G_CALLBACK(clear_buffer)},
 	{"ClearScrollback", GTK_STOCK_CLEAR, N_("_Clear scrollback"), "<shift><control>K", NULL, G_CALLBACK(clear_scrollback)},
-	{"SendFile", GTK_STOCK_JUMP_TO, N_("Send _RAW file"), "<shift><control>R", NULL, G_CALLBACK(send_raw_file)},
+	{"SendFile", GTK_STOCK_JUMP_TO, N_("Send _file"), "<shift><control>R", NULL, G_CALLBACK(send_raw_file)},
+	{"SendHexFile", GTK_STOCK_JUMP_TO, N_("Send _hexadecimal file"), "", NULL, G_CALLBACK(send_hex_file)},
+	{"ReceiveFile", GTK_STOCK_GOTO_BOTTOM, N_("Rece_ive file"), "", NULL, G_CALLBACK(receive_file)},
 	{"SaveFile", GTK_STOCK_SAVE_AS, N_("_Save RAW file"), "", NULL, G_CALLBACK(save_raw_file)},
         {"SaveAsciiFile", GTK_STOCK_SAVE_AS, N_("Save _ASCII file"), "", NULL, G_CALLBACK(save_ascii_file)},
 
@@ -190,6 +206,10 @@ const GtkActionEntry menu_entries[] =
 	{"SignalsClosePort", GTK_STOCK_CLOSE, N_("_Close Port"), "F6", NULL, G_CALLBACK(signals_close_port)},
 	{"SignalsDTR", NULL, N_("Toggle DTR"), "F7", NULL, G_CALLBACK(signals_toggle_DTR_callback)},
 	{"SignalsRTS", NULL, N_("Toggle RTS"), "F8", NULL, G_CALLBACK(signals_toggle_RTS_callback)},
+	{"SignalsLatency", NULL, N_("Measure _latency (TX wired to RX)"), NULL, NULL, G_CALLBACK(signals_latency_test_callback)},
+
+	/* View menu */
+	{"ViewStatistics", GTK_STOCK_INFO, N_("S_tatistics"), NULL, NULL, G_CALLBACK(view_statistics_callback)},
 
 	/* About menu */
 	{"HelpAbout", GTK_STOCK_ABOUT, NULL, NULL, NULL, G_CALLBACK(help_about_callback)}
@@ -231,6 +251,8 @@ static const char *ui_description =
     "      <menuitem action='ClearScreen'/>"
     "      <menuitem action='ClearScrollback'/>"
     "      <menuitem action='SendFile'/>"
+    "      <menuitem action='SendHexFile'/>"
+    "      <menuitem action='ReceiveFile'/>"
     "      <menuitem action='SaveFile'/>"
     "      <menuitem action='SaveAsciiFile'/>"
     "      <separator/>"
@@ -269,6 +291,8 @@ static const char *ui_description =
     "      <menuitem action='SignalsClosePort'/>"
     "      <menuitem action='SignalsDTR'/>"
     "      <menuitem action='SignalsRTS'/>"
+    "      <separator/>"
+    "      <menuitem action='SignalsLatency'/>"
     "    </menu>"
     "    <menu action='View'>"
     "      <menuitem action='ViewASCII'/>"
@@ -283,6 +307,7 @@ static const char *ui_description =
     "      <menuitem action='ViewIndex'/>"
     "      <separator/>"
     "      <menuitem action='ViewSendHexData'/>"
+    "      <menuitem action='ViewStatistics'/>"
     "    </menu>"
     "    <menu action='Help'>"
     "      <menuitem action='HelpAbout'/>"
@@ -310,6 +335,32 @@ void view_send_hex_toggled_callback(GtkAction *action, gpointer data)
 		gtk_widget_hide(GTK_WIDGET(Hex_Box));
 }
 
+void view_statistics_callback(GtkAction *action, gpointer data)
+{
+	GtkWidget *dialog;
+	GString *statistics;
+
+	statistics = g_string_new(NULL);
+	serial_append_statistics(statistics);
+	latency_append_statistics(statistics);
+	rx_thread_append_statistics(statistics);
+	render_append_statistics(statistics);
+	pacing_append_statistics(statistics);
+	transfer_append_statistics(statistics);
+	logging_append_statistics(statistics);
+
+	dialog = gtk_message_dialog_new(GTK_WINDOW(Fenetre),
+	                                GTK_DIALOG_DESTROY_WITH_PARENT,
+	                                GTK_MESSAGE_INFO,
+	                                GTK_BUTTONS_CLOSE,
+	                                "%s", statistics->str);
+	gtk_window_set_title(GTK_WINDOW(dialog), _("Statistics"));
+	g_string_free(statistics, TRUE);
+
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+}
+
 void view_index_toggled_callback(GtkAction *action, gpointer data)
 {
 	show_index = gtk_toggle_action_get_active(GTK_TOGGLE_ACTION(action));
@@ -325,6 +376,28 @@ void view_hexadecimal_chars_radio_callback(GtkAction* action, gpointer data)
 	set_view(HEXADECIMAL_VIEW);
 }
 
+/* Only replay the part of the history the terminal can show or keep */
+/* in its scrollback, VTE would drop the rest anyway                  */
+static void write_history_tail(void)
+{
+	guint64 offset;
+	glong lines, columns;
+
+	if(term_conf.scrollback < 0)
+	{
+		write_buffer();
+		return;
+	}
+
+	lines = term_conf.scrollback + vte_terminal_get_row_count(VTE_TERMINAL(display));
+	columns = vte_terminal_get_column_count(VTE_TERMINAL(display));
+
+	/* a line can hold escape sequences and multibyte characters */
+	offset = buffer_tail_offset(lines, (guint64)lines * columns * 4);
+
+	write_buffer_from(offset);
+}
+
 void set_view(guint type)
 {
 	GtkAction *action;
@@ -343,22 +416,26 @@ void set_view(guint type)
 		gtk_toggle_action_set_active(GTK_TOGGLE_ACTION(action), TRUE);
 		gtk_action_set_sensitive(show_index_action, FALSE);
 		gtk_action_set_sensitive(hex_chars_action, FALSE);
-		total_bytes = 0;
+		gtk_widget_hide(hex_view);
+		gtk_widget_show(scrolled_window);
 		set_display_func(put_text);
+		write_history_tail();
 		break;
 	case HEXADECIMAL_VIEW:
 		action = gtk_action_group_get_action(action_group, "ViewHexadecimal");
 		gtk_toggle_action_set_active(GTK_TOGGLE_ACTION(action), TRUE);
 		gtk_action_set_sensitive(show_index_action, TRUE);
 		gtk_action_set_sensitive(hex_chars_action, TRUE);
-		total_bytes = 0;
-		virt_col_pos = 0;
+		gtk_widget_hide(scrolled_window);
+		gtk_widget_show(hex_view);
+		/* the hexadecimal view reads the buffer itself, nothing to replay */
+		hexview_set_format(bytes_per_line, show_index);
 		set_display_func(put_hexadecimal);
 		break;
 	default:
 		set_display_func(NULL);
 	}
-	write_buffer();
+	update_copy_sensivity(VTE_TERMINAL(display), NULL);
 }
 
 void view_radio_callback(GtkAction *action, gpointer data)
@@ -498,6 +575,11 @@ void terminal_popup_menu_callback(GtkWidget *widget, gpointer data)
 	               0, gtk_get_current_event_time());
 }
 
+static void hexview_selection_changed(void)
+{
+	update_copy_sensivity(VTE_TERMINAL(display), NULL);
+}
+
 void create_main_window(void)
 {
 	GtkWidget *menu, *main_vbox, *label;
@@ -559,6 +641,7 @@ void create_main_window(void)
 
 	/* create vte window */
 	display = vte_terminal_new();
+	render_init(display);
 
 	/* set terminal properties, these could probably be made user configurable */
 	vte_terminal_set_scroll_on_output(VTE_TERMINAL(display), FALSE);
@@ -586,6 +669,16 @@ void create_main_window(void)
 
 	gtk_box_pack_start(GTK_BOX(main_vbox), scrolled_window, TRUE, TRUE, 0);
 
+	/* hexadecimal view, shown instead of the terminal */
+	hex_view = hexview_new();
+	gtk_widget_set_no_show_all(hex_view, TRUE);
+	gtk_box_pack_start(GTK_BOX(main_vbox), hex_view, TRUE, TRUE, 0);
+	g_signal_connect(G_OBJECT(hex_view), "button-press-event",
+	                 G_CALLBACK(terminal_button_press_callback), NULL);
+	g_signal_connect(G_OBJECT(hex_view), "key-press-event",
+	                 G_CALLBACK(Envoie_car), NULL);
+	hexview_set_selection_func(hexview_selection_changed);
+
 	g_signal_connect(G_OBJECT(display), "button-press-event",
 	                 G_CALLBACK(terminal_button_press_callback), NULL);
 
@@ -641,9 +734,18 @@ void create_main_window(void)
 	gtk_box_pack_end(GTK_BOX(StatusBar), label, FALSE, TRUE, 5);
 	signals[5] = label;
 
+	buffer_usage_label = gtk_label_new(NULL);
+	gtk_box_pack_end(GTK_BOX(StatusBar), buffer_usage_label, FALSE, TRUE, 10);
+	buffer_usage_update();
+
+	tx_queue_label = gtk_label_new(NULL);
+	gtk_box_pack_end(GTK_BOX(StatusBar), tx_queue_label, FALSE, TRUE, 10);
+
 	g_signal_connect_after(GTK_WIDGET(display), "commit", G_CALLBACK(Got_Input), NULL);
 
 	g_timeout_add(POLL_DELAY, (GSourceFunc)control_signals_read, NULL);
+	g_timeout_add_seconds(1, (GSourceFunc)buffer_usage_update, NULL);
+	g_timeout_add_seconds(1, (GSourceFunc)tx_queue_update, NULL);
 
 	gtk_window_set_default_size(GTK_WINDOW(Fenetre), 750, 550);
 	gtk_widget_show_all(Fenetre);
@@ -653,82 +755,50 @@ void create_main_window(void)
 
 void initialize_hexadecimal_display(void)
 {
-	total_bytes = 0;
-	memset(blank_data, ' ', 128);
-	blank_data[bytes_per_line * 3 + 5] = 0;
+	static const gchar digits[] = "0123456789ABCDEF";
+	gint i;
+
+	if(hex_log != NULL)
+		return;
+
+	for(i = 0; i < 256; i++)
+	{
+		hex_digits[i][0] = digits[i >> 4];
+		hex_digits[i][1] = digits[i & 0x0F];
+	}
+
+	hex_log = g_string_sized_new(BUFFER_RECEPTION * 3);
 }
 
+/* The data is already in the buffer, where the hexadecimal view reads
+   it: only the log needs a formatted copy */
 void put_hexadecimal(const gchar *string, guint size)
 {
-	static gchar data[128];
-	static gchar data_byte[6];
-	gint i = 0;
+	guint i;
+	guchar c;
 
 	if(size == 0)
 		return;
 
-	while(i < size)
+	if(logging_active())
 	{
-		while(gtk_events_pending()) gtk_main_iteration();
-
-		/* Print hexadecimal characters */
-		data[0] = 0;
-
-		while(virt_col_pos < bytes_per_line && i < size)
+		g_string_truncate(hex_log, 0);
+		for(i = 0; i < size; i++)
 		{
-			gint avance=0;
-			gchar ascii[1];
-
-			if(show_index)
-			{
-				/* First byte on line */
-				if(virt_col_pos == 0)
-				{
-					sprintf(data, "%6d: ", total_bytes);
-					vte_terminal_feed(VTE_TERMINAL(display), data, strlen(data));
-				}
-			}
-
-			sprintf(data_byte, "%02X ", (guchar)string[i]);
-			log_chars(data_byte, 3);
-			vte_terminal_feed(VTE_TERMINAL(display), data_byte, 3);
-
-			avance = (bytes_per_line - virt_col_pos) * 3 + virt_col_pos + 2;
-			/* Move forward */
-			sprintf(data_byte, "%c[%dC", 27, avance);
-			vte_terminal_feed(VTE_TERMINAL(display), data_byte, strlen(data_byte));
-
-			/* Print ascii characters */
-			ascii[0] = (string[i] > 0x1F) ? string[i] : '.';
-			vte_terminal_feed(VTE_TERMINAL(display), ascii, 1);
-
-			/* Move backward */
-			sprintf(data_byte, "%c[%dD", 27, avance + 1);
-			vte_terminal_feed(VTE_TERMINAL(display), data_byte, strlen(data_byte));
-
-			if(virt_col_pos == bytes_per_line / 2 - 1)
-				vte_terminal_feed(VTE_TERMINAL(display), "- ", strlen("- "));
-
-			virt_col_pos++;
-			i++;
-
-			/* End of line ? */
-			if(virt_col_pos == bytes_per_line)
-			{
-				vte_terminal_feed(VTE_TERMINAL(display), "\r\n", 2);
-				total_bytes += virt_col_pos;
-				virt_col_pos = 0;
-			}
-
+			c = (guchar)string[i];
+			g_string_append_len(hex_log, hex_digits[c], 2);
+			g_string_append_c(hex_log, ' ');
 		}
-
+		log_chars(hex_log->str, hex_log->len);
 	}
+
+	hexview_data_changed();
 }
 
 void put_text(const gchar *string, guint size)
 {
 	log_chars(string, size);
-	vte_terminal_feed(VTE_TERMINAL(display), string, size);
+	render_feed(string, size);
 }
 
 gint send_serial(gchar *string, gint len)
@@ -748,7 +818,8 @@ gint send_serial(gchar *string, gint len)
 
 static void Got_Input(VteTerminal *widget, gchar *text, guint length, gpointer ptr)
 {
-	send_serial(text, length);
+	/* typed keys, or a paste */
+	send_paste(text, length);
 }
 
 gboolean Envoie_car(GtkWidget *widget, GdkEventKey *event, gpointer pointer)
@@ -819,6 +890,11 @@ void signals_send_break_callback(GtkAction *action, gpointer data)
 	Put_temp_message(_("Break signal sent!"), 800);
 }
 
+void signals_latency_test_callback(GtkAction *action, gpointer data)
+{
+	latency_test_start();
+}
+
 void signals_toggle_DTR_callback(GtkAction *action, gpointer data)
 {
 	Set_signals(0);
@@ -850,6 +926,49 @@ gboolean control_signals_read(void)
 	return TRUE;
 }
 
+gboolean buffer_usage_update(void)
+{
+	guint64 used, resident, size;
+	gchar *message;
+
+	get_buffer_usage(&used, &resident, &size);
+
+	message = g_strdup_printf(_("History: %" G_GUINT64_FORMAT " / %" G_GUINT64_FORMAT " KiB"),
+	                          used / 1024, size / 1024);
+	gtk_label_set_text(GTK_LABEL(buffer_usage_label), message);
+	g_free(message);
+
+	if(get_buffer_file() != NULL)
+		message = g_strdup_printf(_("%s, %" G_GUINT64_FORMAT " KiB mapped"),
+		                          get_buffer_file(), resident / 1024);
+	else
+		message = g_strdup_printf(_("%" G_GUINT64_FORMAT " KiB allocated"), resident / 1024);
+	gtk_widget_set_tooltip_text(buffer_usage_label, message);
+	g_free(message);
+
+	return TRUE;
+}
+
+/* Only shown while something is being sent */
+gboolean tx_queue_update(void)
+{
+	guint queued = serial_tx_queued();
+	gdouble rate = serial_tx_rate();
+	gchar *message;
+
+	if(queued == 0 && rate == 0)
+	{
+		gtk_label_set_text(GTK_LABEL(tx_queue_label), "");
+		return TRUE;
+	}
+
+	message = g_strdup_printf(_("TX: %u KiB queued, %.1f KiB/s"), (queued + 1023) / 1024, rate / 1024);
+	gtk_label_set_text(GTK_LABEL(tx_queue_label), message);
+	g_free(message);
+
+	return TRUE;
+}
+
 void Set_status_message(gchar *msg)
 {
 	gtk_statusbar_pop(GTK_STATUSBAR(StatusBar), id);
@@ -905,6 +1024,14 @@ void show_message(gchar *message, gint type_msg)
 		                                     GTK_BUTTONS_OK,
 		                                     message, NULL);
 	}
+	else if(type_msg==MSG_INF)
+	{
+		Fenetre_msg = gtk_message_dialog_new(GTK_WINDOW(Fenetre),
+		                                     GTK_DIALOG_DESTROY_WITH_PARENT,
+		                                     GTK_MESSAGE_INFO,
+		                                     GTK_BUTTONS_OK,
+		                                     message, NULL);
+	}
 	else
 		return;
 
@@ -914,43 +1041,51 @@ void show_message(gchar *message, gint type_msg)
 
 gboolean Send_Hexadecimal(GtkWidget *widget, GdkEventKey *event, gpointer pointer)
 {
-	guint i;
-	gchar *text, *message, **tokens, *buff;
-	guint scan_val;
+	hex_decoder_t decoder;
+	const gchar *text;
+	gchar *message;
+	guint8 *buff;
+	gssize size, last;
+	glong error;
+
+	text = gtk_entry_get_text(GTK_ENTRY(widget));
 
-	text = (gchar *)gtk_entry_get_text(GTK_ENTRY(widget));
+	buff = g_malloc(HEX_DECODE_SIZE(strlen(text)));
+	hex_decoder_init(&decoder);
+	size = hex_decode(&decoder, text, strlen(text), buff);
+	if(size != -1)
+	{
+		last = hex_decode_finish(&decoder, buff + size);
+		size = (last == -1) ? -1 : size + last;
+	}
 
-	if(strlen(text) == 0)
+	if(size == -1)
 	{
-		message = g_strdup_printf(_("0 byte(s) sent!"));
-		Put_temp_message(message, 1500);
-		gtk_entry_set_text(GTK_ENTRY(widget), "");
+		/* the text stays, with the culprit selected */
+		error = g_utf8_pointer_to_offset(text, text + decoder.error);
+		message = g_strdup_printf(_("Improper formatted hex input at character %ld, 0 bytes sent!"), error + 1);
+		Put_temp_message(message, 3000);
 		g_free(message);
+		gtk_editable_select_region(GTK_EDITABLE(widget), error, error + 1);
+		g_free(buff);
 		return FALSE;
 	}
 
-	tokens = g_strsplit_set(text, " ;", -1);
-	buff = g_malloc(g_strv_length(tokens));
-
-	for(i = 0; tokens[i] != NULL; i++)
+	/* in chunks through the transmit queue, like a file */
+	if(size != 0 && !send_hexadecimal_data(buff, size))
 	{
-		if(sscanf(tokens[i], "%02X", &scan_val) != 1)
-		{
-			Put_temp_message(_("Improper formatted hex input, 0 bytes sent!"),
-			                 1500);
-			g_free(buff);
-			return FALSE;
-		}
-		buff[i] = scan_val;
+		/* the text stays, to be sent once the file is */
+		Put_temp_message(_("Wait for the file to be sent"), 2000);
+		g_free(buff);
+		return FALSE;
 	}
+	if(size == 0)
+		g_free(buff);
 
-	send_serial(buff, i);
-	g_free(buff);
-
-	message = g_strdup_printf(_("%d byte(s) sent!"), i);
+	message = g_strdup_printf(_("%d byte(s) sent!"), (gint)size);
 	Put_temp_message(message, 2000);
 	gtk_entry_set_text(GTK_ENTRY(widget), "");
-	g_strfreev(tokens);
+	g_free(message);
 
 	return FALSE;
 }
@@ -972,13 +1107,16 @@ gboolean pop_message(void)
 void clear_display(void)
 {
 	initialize_hexadecimal_display();
-	if(display)
-		vte_terminal_reset(VTE_TERMINAL(display), TRUE, TRUE);
+	render_clear();
+	hexview_clear();
 }
 
 void edit_copy_callback(GtkAction *action, gpointer data)
 {
-	vte_terminal_copy_clipboard(VTE_TERMINAL(display));
+	if(gtk_widget_get_visible(hex_view))
+		hexview_copy_clipboard();
+	else
+		vte_terminal_copy_clipboard(VTE_TERMINAL(display));
 }
 
 void update_copy_sensivity(VteTerminal *terminal, gpointer data)
@@ -986,7 +1124,10 @@ void update_copy_sensivity(VteTerminal *terminal, gpointer data)
 	GtkAction *action;
 	gboolean can_copy;
 
-	can_copy = vte_terminal_get_has_selection(VTE_TERMINAL(terminal));
+	if(hex_view != NULL && gtk_widget_get_visible(hex_view))
+		can_copy = hexview_has_selection();
+	else
+		can_copy = vte_terminal_get_has_selection(VTE_TERMINAL(display));
 
 	action = gtk_action_group_get_action(action_group, "EditCopy");
 	gtk_action_set_sensitive(action, can_copy);
@@ -1007,5 +1148,8 @@ void edit_find_callback(GtkAction *action)
 
 void edit_select_all_callback(GtkAction *action, gpointer data)
 {
-	vte_terminal_select_all(VTE_TERMINAL(display));
+	if(gtk_widget_get_visible(hex_view))
+		hexview_select_all();
+	else
+		vte_terminal_select_all(VTE_TERMINAL(display));
 }
@@ -17,6 +17,7 @@
 
 #define MSG_WRN 0
 #define MSG_ERR 1
+#define MSG_INF 2
 
 #define ASCII_VIEW 0
 #define HEXADECIMAL_VIEW 1
@@ -0,0 +1,170 @@
+/***********************************************************************/
+/* latency.c                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Round-trip latency measurement through a loopback              */
+/*                                                                     */
+/*      Short probes are sent one after the other, and the time until  */
+/*      each of them is received back is measured where the received   */
+/*      data is processed, so it includes the driver, the adapter and  */
+/*      the reception by GTKTerm. TX must be wired to RX.              */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <string.h>
+
+#include "term_config.h"
+#include "serial.h"
+#include "interface.h"
+#include "latency.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+static gboolean running = FALSE;
+static guint probe_number;
+static gchar probe[32];
+static guint probe_length;
+static guint matched;
+static gint64 probe_sent;
+static guint timeout_id = 0;
+
+/* Results of the last test, in us */
+static guint received;
+static guint lost;
+static gint64 rtt_min, rtt_max, rtt_total;
+static gboolean has_results = FALSE;
+
+extern struct configuration_port config;
+
+static void send_probe(void);
+
+static gboolean probe_timeout(gpointer data)
+{
+	timeout_id = 0;
+	lost++;
+	send_probe();
+
+	return FALSE;
+}
+
+/* Not from send_probe(): the dialog must not run inside the reception */
+static gboolean report(gpointer data)
+{
+	GString *message = g_string_new(NULL);
+
+	latency_append_statistics(message);
+	show_message(message->str, MSG_INF);
+	g_string_free(message, TRUE);
+
+	return FALSE;
+}
+
+static void send_probe(void)
+{
+	if(probe_number == LATENCY_PROBES || serial_port_fd == -1)
+	{
+		running = FALSE;
+		has_results = TRUE;
+		g_idle_add(report, NULL);
+		return;
+	}
+
+	probe_length = g_snprintf(probe, sizeof(probe), "{latency %02u}\r\n", probe_number++);
+	matched = 0;
+
+	probe_sent = g_get_monotonic_time();
+	if(Send_chars(probe, probe_length) != (int)probe_length)
+	{
+		running = FALSE;
+		show_message(_("Cannot send the latency probe"), MSG_ERR);
+		return;
+	}
+
+	timeout_id = g_timeout_add(LATENCY_TIMEOUT, probe_timeout, NULL);
+}
+
+void latency_test_start(void)
+{
+	if(running)
+		return;
+
+	if(serial_port_fd == -1)
+	{
+		show_message(_("The port is not open"), MSG_ERR);
+		return;
+	}
+
+	running = TRUE;
+	has_results = FALSE;
+	probe_number = 0;
+	received = 0;
+	lost = 0;
+	rtt_min = G_MAXINT64;
+	rtt_max = 0;
+	rtt_total = 0;
+
+	send_probe();
+}
+
+/* Looks for the current probe in the received data */
+void latency_test_received(const gchar *chars, guint size)
+{
+	gint64 rtt;
+	guint i;
+
+	if(!running || timeout_id == 0)
+		return;
+
+	for(i = 0; i < size; i++)
+	{
+		if(chars[i] == probe[matched])
+			matched++;
+		else
+			matched = chars[i] == probe[0] ? 1 : 0;
+
+		if(matched == probe_length)
+		{
+			rtt = g_get_monotonic_time() - probe_sent;
+			rtt_min = MIN(rtt_min, rtt);
+			rtt_max = MAX(rtt_max, rtt);
+			rtt_total += rtt;
+			received++;
+
+			g_source_remove(timeout_id);
+			timeout_id = 0;
+			send_probe();
+			return;
+		}
+	}
+}
+
+void latency_append_statistics(GString *string)
+{
+	gint bits;
+
+	if(!has_results)
+		return;
+
+	/* start bit, data bits, parity bit and stop bits */
+	bits = 1 + config.bits + (config.parite != 0 ? 1 : 0) + config.stops;
+
+	if(received == 0)
+		g_string_append_printf(string, _("Loopback latency: no probe received back (%u lost)\n"), lost);
+	else
+		g_string_append_printf(string,
+		                       _("Loopback latency over %u probes (%u lost):\n"
+		                         "  Round trip: %.2f ms min, %.2f ms average, %.2f ms max\n"
+		                         "  Including the transmission of %u bytes: %.2f ms\n"),
+		                       received, lost,
+		                       rtt_min / 1000.0, rtt_total / 1000.0 / received, rtt_max / 1000.0,
+		                       probe_length,
+		                       config.vitesse > 0 ? probe_length * bits * 1000.0 / config.vitesse : 0.0);
+}
@@ -0,0 +1,25 @@
+/***********************************************************************/
+/* latency.h                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Round-trip latency measurement through a loopback              */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#define LATENCY_PROBES 20
+#define LATENCY_TIMEOUT 1000         /* per probe, in ms */
+
+void latency_test_start(void);
+void latency_test_received(const gchar *, guint);
+void latency_append_statistics(GString *);
+
+#endif
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -26,22 +27,310 @@
 
 #include "interface.h"
 #include "serial.h"
+#include "term_config.h"
 #include "buffer.h"
 #include "logging.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
-#define MAX_WRITE_ATTEMPTS 5
+/* The data is copied into a buffer by the main loop and handed to a
+   writer thread once the buffer is full, or config.log_flush_time ms
+   after its first byte. The buffers go round a single-producer /
+   single-consumer queue: the main loop never waits for the disk,
+   unless all of them are queued */
+typedef struct
+{
+	gchar *data;
+	volatile gsize length;
+} log_buffer_t;
 
 static gboolean	  Logging;
 static gchar     *LoggingFileName;
-static FILE      *LoggingFile;
+static volatile int LoggingFile = -1;
 static gchar     *logfile_default = NULL;
 
+static log_buffer_t buffers[LOG_BUFFERS];
+static gsize buffer_size = 0;
+static volatile gsize filled = 0;      /* of the buffer at queue_head */
+static volatile gint queue_head;       /* only written by the main loop */
+static volatile gint queue_tail;       /* only written by the writer thread */
+static volatile gsize written;         /* of the buffer at queue_tail */
+static guint flush_timer = 0;
+
+static GThread *writer = NULL;
+static GMutex queue_mutex;
+static GCond writer_wakeup;
+static GCond buffer_free;
+static gboolean writer_stop;
+static volatile gint write_error = 0;
+
+extern struct configuration_port config;
+
+/* Statistics */
+static GMutex stats_mutex;
+static guint64 bytes_logged = 0;
+static guint64 bytes_written = 0;
+static guint64 writes = 0;
+static guint64 size_flushes = 0;
+static guint64 time_flushes = 0;
+static guint64 stalls = 0;
+static guint queue_high_water = 0;
+
+static gboolean write_error_report(gpointer data);
+
+static gboolean write_all(const gchar *data, gsize length)
+{
+	gssize bytes;
+
+	while(length > 0)
+	{
+		bytes = write(LoggingFile, data, length);
+		if(bytes < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += bytes;
+		length -= bytes;
+		written += bytes;
+	}
+
+	return TRUE;
+}
+
+static gpointer writer_thread(gpointer data)
+{
+	guint head, tail;
+	log_buffer_t *buffer;
+
+	tail = g_atomic_int_get(&queue_tail);
+
+	while(TRUE)
+	{
+		g_mutex_lock(&queue_mutex);
+		while((head = g_atomic_int_get(&queue_head)) == tail && !writer_stop)
+			g_cond_wait(&writer_wakeup, &queue_mutex);
+		g_mutex_unlock(&queue_mutex);
+
+		/* stopped, once everything is written */
+		if(head == tail)
+			break;
+
+		for(; tail != head; tail++)
+		{
+			buffer = &buffers[tail % LOG_BUFFERS];
+
+			/* after an error, the data is dropped so the main loop */
+			/* does not wait for buffers which will never be free   */
+			if(!g_atomic_int_get(&write_error) && !write_all(buffer->data, buffer->length))
+			{
+				g_atomic_int_set(&write_error, errno);
+				g_idle_add(write_error_report, NULL);
+			}
+
+			g_mutex_lock(&stats_mutex);
+			bytes_written += buffer->length;
+			writes++;
+			g_mutex_unlock(&stats_mutex);
+
+			g_mutex_lock(&queue_mutex);
+			written = 0;
+			g_atomic_int_set(&queue_tail, tail + 1);
+			g_cond_signal(&buffer_free);
+			g_mutex_unlock(&queue_mutex);
+		}
+	}
+
+	return NULL;
+}
+
+/* Hands the buffer being filled to the writer thread */
+static void flush_buffer(void)
+{
+	guint head;
+
+	if(filled == 0)
+		return;
+
+	head = g_atomic_int_get(&queue_head);
+	buffers[head % LOG_BUFFERS].length = filled;
+	filled = 0;
+
+	g_mutex_lock(&queue_mutex);
+	g_atomic_int_set(&queue_head, head + 1);
+	g_cond_signal(&writer_wakeup);
+	g_mutex_unlock(&queue_mutex);
+
+	head = head + 1 - (guint)g_atomic_int_get(&queue_tail);
+	if(head > queue_high_water)
+		queue_high_water = head;
+}
+
+/* Until the buffer at queue_head is not queued any more */
+static void wait_buffer_free(void)
+{
+	guint head = g_atomic_int_get(&queue_head);
+
+	if(head - (guint)g_atomic_int_get(&queue_tail) < LOG_BUFFERS)
+		return;
+
+	stalls++;
+	g_mutex_lock(&queue_mutex);
+	while(head - (guint)g_atomic_int_get(&queue_tail) == LOG_BUFFERS)
+		g_cond_wait(&buffer_free, &queue_mutex);
+	g_mutex_unlock(&queue_mutex);
+}
+
+/* Until everything is written */
+static void wait_written(void)
+{
+	flush_buffer();
+
+	g_mutex_lock(&queue_mutex);
+	while(g_atomic_int_get(&queue_tail) != g_atomic_int_get(&queue_head))
+		g_cond_wait(&buffer_free, &queue_mutex);
+	g_mutex_unlock(&queue_mutex);
+}
+
+static gboolean flush_timeout(gpointer data)
+{
+	flush_timer = 0;
+	if(filled != 0)
+		time_flushes++;
+	flush_buffer();
+
+	return FALSE;
+}
+
+/* Only async-signal-safe calls: whatever is left is written as is */
+static void crash_handler(int signal_number)
+{
+	guint head, tail;
+	gsize offset;
+	gboolean failed = FALSE;
+
+	if(LoggingFile != -1)
+	{
+		head = queue_head;
+		tail = queue_tail;
+		for(offset = written; tail != head && !failed; tail++, offset = 0)
+		{
+			if(offset < buffers[tail % LOG_BUFFERS].length)
+				failed = write(LoggingFile, buffers[tail % LOG_BUFFERS].data + offset,
+				               buffers[tail % LOG_BUFFERS].length - offset) < 0;
+		}
+		if(!failed && filled != 0)
+			failed = write(LoggingFile, buffers[head % LOG_BUFFERS].data, filled) < 0;
+	}
+
+	/* SA_RESETHAND has restored the default action */
+	raise(signal_number);
+}
+
+static void catch_crashes(void)
+{
+	static gboolean caught = FALSE;
+	static const int signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+	struct sigaction action;
+	guint i;
+
+	if(caught)
+		return;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = crash_handler;
+	action.sa_flags = SA_RESETHAND | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	for(i = 0; i < G_N_ELEMENTS(signals); i++)
+		sigaction(signals[i], &action, NULL);
+
+	caught = TRUE;
+}
+
+static void writer_start(int fd)
+{
+	guint i;
+
+	buffer_size = (gsize)config.log_buffer_size * 1024;
+	for(i = 0; i < LOG_BUFFERS; i++)
+	{
+		buffers[i].data = g_malloc(buffer_size);
+		buffers[i].length = 0;
+	}
+	filled = 0;
+	queue_head = 0;
+	queue_tail = 0;
+	written = 0;
+	writer_stop = FALSE;
+	write_error = 0;
+
+	g_mutex_lock(&stats_mutex);
+	bytes_logged = 0;
+	bytes_written = 0;
+	writes = 0;
+	size_flushes = 0;
+	time_flushes = 0;
+	stalls = 0;
+	queue_high_water = 0;
+	g_mutex_unlock(&stats_mutex);
+
+	LoggingFile = fd;
+	catch_crashes();
+
+	writer = g_thread_new("log-writer", writer_thread, NULL);
+}
+
+/* Writes what is left and closes the file */
+static void writer_stop_and_close(void)
+{
+	guint i;
+
+	if(flush_timer != 0)
+		g_source_remove(flush_timer);
+	flush_timer = 0;
+
+	flush_buffer();
+
+	g_mutex_lock(&queue_mutex);
+	writer_stop = TRUE;
+	g_cond_signal(&writer_wakeup);
+	g_mutex_unlock(&queue_mutex);
+	g_thread_join(writer);
+	writer = NULL;
+
+	close(LoggingFile);
+	LoggingFile = -1;
+
+	for(i = 0; i < LOG_BUFFERS; i++)
+	{
+		g_free(buffers[i].data);
+		buffers[i].data = NULL;
+	}
+}
+
+static gboolean write_error_report(gpointer data)
+{
+	gchar *str;
+	gint error = g_atomic_int_get(&write_error);
+
+	if(LoggingFile == -1 || error == 0)
+		return FALSE;
+
+	str = g_strdup_printf(_("Failed to log data: %s\n"), strerror(error));
+	show_message(str, MSG_ERR);
+	g_free(str);
+
+	logging_stop();
+
+	return FALSE;
+}
+
 static gint OpenLogFile(gchar *filename)
 {
 	gchar *str;
+	int fd;
 
 	// open file and start logging
 	if(!filename || (strcmp(filename, "") == 0))
@@ -53,26 +342,28 @@ static gint OpenLogFile(gchar *filename)
 		return FALSE;
 	}
 
-	if(LoggingFile != NULL)
+	if(LoggingFile != -1)
 	{
-		fclose(LoggingFile);
-		LoggingFile = NULL;
+		writer_stop_and_close();
+		g_free(LoggingFileName);
 		Logging = FALSE;
 	}
 
 	LoggingFileName = filename;
 
-	LoggingFile = fopen(LoggingFileName, "a");
-	if(LoggingFile == NULL)
+	fd = open(LoggingFileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if(fd == -1)
 	{
 		str = g_strdup_printf(_("Cannot open file %s: %s\n"), LoggingFileName, strerror(errno));
 
 		show_message(str, MSG_ERR);
 		g_free(str);
 		g_free(LoggingFileName);
+		LoggingFileName = NULL;
 	}
 	else
 	{
+		writer_start(fd);
 		logfile_default = g_strdup(LoggingFileName);
 		Logging = TRUE;
 	}
@@ -110,32 +401,32 @@ void logging_start(GtkAction *action, gpointer data)
 
 void logging_clear(void)
 {
-	if(LoggingFile == NULL)
+	if(LoggingFile == -1)
 	{
 		return;
 	}
 
-	//Reopening with "w" will truncate the file
-	LoggingFile = freopen(LoggingFileName, "w", LoggingFile);
+	//Truncate once everything logged so far is in the file
+	wait_written();
 
-	if (LoggingFile == NULL)
+	if(ftruncate(LoggingFile, 0) == -1)
 	{
-		gchar *str = g_strdup_printf(_("Cannot open file %s: %s\n"), LoggingFileName, strerror(errno));
+		gchar *str = g_strdup_printf(_("Cannot clear file %s: %s\n"), LoggingFileName, strerror(errno));
 		show_message(str, MSG_ERR);
 		g_free(str);
-		g_free(LoggingFileName);
 	}
 }
 
 void logging_pause_resume(void)
 {
-	if(LoggingFile == NULL)
+	if(LoggingFile == -1)
 	{
 		return;
 	}
 	if(Logging == TRUE)
 	{
 		Logging = FALSE;
+		flush_buffer();
 	}
 	else
 	{
@@ -144,47 +435,87 @@ void logging_pause_resume(void)
 	toggle_logging_pause_resume(Logging);
 }
 
-void logging_stop(void)
+/* Without touching the interface, which may be gone */
+void logging_close(void)
 {
-	if(LoggingFile == NULL)
+	if(LoggingFile == -1)
 	{
 		return;
 	}
 
-	fclose(LoggingFile);
-	LoggingFile = NULL;
+	writer_stop_and_close();
 	Logging = FALSE;
 	g_free(LoggingFileName);
 	LoggingFileName = NULL;
+}
+
+void logging_stop(void)
+{
+	if(LoggingFile == -1)
+	{
+		return;
+	}
+
+	logging_close();
 
 	toggle_logging_sensitivity(Logging);
 	toggle_logging_pause_resume(Logging);
 }
 
-void log_chars(gchar *chars, guint size)
+gboolean logging_active(void)
+{
+	return LoggingFile != -1 && Logging;
+}
+
+void log_chars(const gchar *chars, guint size)
 {
-	guint writeAttempts = 0;
-	guint bytesWritten = 0;
+	gsize length;
 
 	/* if we are not logging exit */
-	if(LoggingFile == NULL || Logging == FALSE)
+	if(LoggingFile == -1 || Logging == FALSE)
 	{
 		return;
 	}
 
-	while (bytesWritten < size)
+	bytes_logged += size;
+
+	while(size > 0)
 	{
-		if (writeAttempts < MAX_WRITE_ATTEMPTS)
-		{
-			bytesWritten += fwrite(&chars[bytesWritten], 1,
-			                       size-bytesWritten, LoggingFile);
-		}
-		else
+		wait_buffer_free();
+
+		length = MIN(size, buffer_size - filled);
+		memcpy(buffers[g_atomic_int_get(&queue_head) % LOG_BUFFERS].data + filled, chars, length);
+		filled += length;
+		chars += length;
+		size -= length;
+
+		if(filled == buffer_size)
 		{
-			show_message(_("Failed to log data\n"), MSG_ERR);
-			return;
+			size_flushes++;
+			flush_buffer();
 		}
 	}
 
-	fflush(LoggingFile);
+	if(filled != 0 && flush_timer == 0)
+		flush_timer = g_timeout_add(config.log_flush_time, flush_timeout, NULL);
+}
+
+void logging_append_statistics(GString *string)
+{
+	if(LoggingFile == -1)
+		return;
+
+	g_mutex_lock(&stats_mutex);
+	g_string_append_printf(string,
+	                       _("Log file: %s (%s)\n"
+	                         "  Bytes logged: %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " written in %" G_GUINT64_FORMAT " writes\n"
+	                         "  Buffers: %u of %u KiB, %u queued at most\n"
+	                         "  Flushes: %" G_GUINT64_FORMAT " full, %" G_GUINT64_FORMAT " after %d ms\n"
+	                         "  Waits for the disk: %" G_GUINT64_FORMAT "\n"),
+	                       LoggingFileName, Logging ? _("logging") : _("paused"),
+	                       bytes_logged, bytes_written, writes,
+	                       LOG_BUFFERS, (guint)(buffer_size / 1024), queue_high_water,
+	                       size_flushes, time_flushes, config.log_flush_time,
+	                       stalls);
+	g_mutex_unlock(&stats_mutex);
 }
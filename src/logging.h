@@ -14,10 +14,17 @@
 #ifndef LOGGING_H_
 #define LOGGING_H_
 
+#define LOG_BUFFERS 8                 /* handed to the writer thread in turn */
+#define DEFAULT_LOG_BUFFER_SIZE 64    /* in KiB */
+#define DEFAULT_LOG_FLUSH_TIME 200    /* in ms */
+
 void logging_start(GtkAction *action, gpointer data);
 void logging_pause_resume(void);
 void logging_stop(void);
 void logging_clear(void);
-void log_chars(gchar *chars, guint size);
+void logging_close(void);
+void log_chars(const gchar *chars, guint size);
+gboolean logging_active(void);
+void logging_append_statistics(GString *);
 
 #endif /* LOGGING_H_ */
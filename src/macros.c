@@ -24,6 +24,7 @@
 
 #include "interface.h"
 #include "macros.h"
+#include "script.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
@@ -52,15 +53,15 @@ macro_t *get_shortcuts(gint *size)
 }
 
 
-static void shortcut_callback(gpointer *number)
+/* Decodes the escapes of string into data, which is as long */
+/* as string, and returns the number of bytes                 */
+gint macro_decode(const gchar *string, gchar *data)
 {
-	gchar *string;
-	gchar *str;
-	gint i, length;
+	const gchar *str;
+	gint i, length, size = 0;
 	guchar a;
 	guint val_read;
 
-	string = macros[(long)number].action;
 	length = strlen(string);
 
 	for(i = 0; i < length; i++)
@@ -133,15 +134,77 @@ static void shortcut_callback(gpointer *number)
 				}
 				i++;
 			}
-			send_serial((gchar*)&a, 1);
+			data[size++] = (gchar)a;
 		}
 		else
-		{
-			send_serial(&string[i], 1);
-		}
+			data[size++] = string[i];
+	}
+
+	return size;
+}
+
+/* The actions are compiled once, when the macros are loaded or */
+/* saved, and not each time the shortcut is used                */
+static void compile_macro(macro_t *macro)
+{
+	const gchar *action = macro->action != NULL ? macro->action : "";
+
+	macro->data = NULL;
+	macro->length = 0;
+	macro->script = NULL;
+	macro->error = NULL;
+
+	if(g_str_has_prefix(action, SCRIPT_PREFIX))
+	{
+		macro->script = script_compile(action + strlen(SCRIPT_PREFIX), &macro->error);
+		return;
 	}
 
-	str = g_strdup_printf(_("Macro \"%s\" sent !"), macros[(long)number].shortcut);
+	macro->data = g_malloc(strlen(action) + 1);
+	macro->length = macro_decode(action, macro->data);
+}
+
+/* Returns the first error of the scripts */
+static const gchar *compile_macros(void)
+{
+	const gchar *error = NULL;
+	gint i = 0;
+
+	if(macros == NULL)
+		return NULL;
+
+	while(macros[i].shortcut != NULL)
+	{
+		compile_macro(&macros[i]);
+		if(error == NULL)
+			error = macros[i].error;
+		i++;
+	}
+
+	return error;
+}
+
+static void shortcut_callback(gpointer *number)
+{
+	macro_t *macro = &macros[(long)number];
+	gchar *str;
+
+	if(macro->error != NULL)
+	{
+		show_message(macro->error, MSG_ERR);
+		return;
+	}
+	if(macro->script != NULL)
+	{
+		script_run(macro->script, macro->shortcut);
+		return;
+	}
+
+	/* a single write, and a single echo */
+	if(macro->length != 0 && send_serial(macro->data, macro->length) < (gint)macro->length)
+		str = g_strdup_printf(_("Macro \"%s\" not entirely sent !"), macro->shortcut);
+	else
+		str = g_strdup_printf(_("Macro \"%s\" sent !"), macro->shortcut);
 	Put_temp_message(str, 800);
 	g_free(str);
 }
@@ -154,6 +217,7 @@ void create_shortcuts(macro_t *macro, gint size)
 		memcpy(macros, macro, size * sizeof(macro_t));
 		macros[size].shortcut = NULL;
 		macros[size].action = NULL;
+		compile_macros();
 	}
 	else
 		perror("malloc");
@@ -189,6 +253,9 @@ static void macros_destroy(void)
 	{
 		g_free(macros[i].shortcut);
 		g_free(macros[i].action);
+		g_free(macros[i].data);
+		script_free(macros[i].script);
+		g_free(macros[i].error);
 		/*
 		g_closure_unref(macros[i].closure);
 		*/
@@ -328,6 +395,7 @@ static gboolean Save_shortcuts(GtkWidget *button, gpointer pointer)
 	GtkTreeIter iter;
 	GtkTreeView *treeview = (GtkTreeView *)pointer;
 	GtkTreeModel *model = gtk_tree_view_get_model (treeview);
+	const gchar *error;
 	gint i = 0;
 
 	remove_shortcuts();
@@ -357,6 +425,9 @@ static gboolean Save_shortcuts(GtkWidget *button, gpointer pointer)
 
 			macros[i].shortcut = NULL;
 			macros[i].action = NULL;
+			error = compile_macros();
+			if(error != NULL)
+				show_message((gchar *)error, MSG_ERR);
 		}
 	}
 
@@ -430,6 +501,14 @@ static gboolean Help_screen(GtkWidget *button, gpointer pointer)
 	                                GTK_MESSAGE_INFO,
 	                                GTK_BUTTONS_CLOSE,
 	                                _("The \"action\" field of a macro is the data to be sent on the port. Text can be entered, but also special chars, like \\n, \\t, \\r, etc. You can also enter hexadecimal data preceded by a '\\'. The hexadecimal data should not begin with a letter (eg. use \\0FF and not \\FF)\nExamples :\n\t\"Hello\\n\" sends \"Hello\" followed by a Line Feed\n\t\"Hello\\0A\" does the same thing but the LF is entered in hexadecimal"));
+	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(Dialog), "%s",
+	        _("An action starting with \"#!\" is a script: commands separated by ';', run without blocking the window. Pressing the shortcut again stops it.\n"
+	          "\tsend \"text $var\" 0x0D0A crc16 crc32 : sends strings, hexadecimal bytes, variables and the CRC of what comes before\n"
+	          "\tsleep 200ms : waits, also in s or us\n"
+	          "\texpect \"login:\" 5s : waits for the string to be received, 10 s by default\n"
+	          "\trepeat 1000 ... end : repeats the commands, forever without a count\n"
+	          "\tset n 0, add n 1 : counters\n"
+	          "Example :\n\t#!repeat 1000; send \"reset\\r\"; expect \"login:\"; send \"root\\r\"; sleep 200ms; end"));
 
 	gtk_dialog_run(GTK_DIALOG (Dialog));
 	gtk_widget_destroy(Dialog);
@@ -19,6 +19,10 @@ typedef struct
 {
 	gchar *shortcut;
 	gchar *action;
+	gchar *data;      /* action with the escapes decoded */
+	gsize length;
+	struct script *script;  /* when the action is a script */
+	gchar *error;           /* of the script */
 	GClosure *closure;
 }
 macro_t;
@@ -28,5 +32,6 @@ void remove_shortcuts(void);
 void add_shortcuts(void);
 void create_shortcuts(macro_t *, gint);
 macro_t *get_shortcuts(gint *);
+gint macro_decode(const gchar *, gchar *);
 
 #endif
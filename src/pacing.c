@@ -0,0 +1,186 @@
+/***********************************************************************/
+/* pacing.c                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Microsecond deadlines for the paced file transfers             */
+/*                                                                     */
+/*      The deadlines are absolute, on the monotonic clock, so that    */
+/*      the time taken by the callback does not add up over a file.    */
+/*      They are kept by a timerfd when available, by a millisecond    */
+/*      timeout otherwise. How late each deadline is handled is        */
+/*      measured and reported as the jitter of the transfer.           */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "pacing.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+static GSourceFunc tick_callback = NULL;
+static gint64 deadline = 0;
+static guint source_id = 0;
+#ifdef HAVE_SYS_TIMERFD_H
+static int timer_fd = -1;
+#endif
+
+static pacing_stats_t stats;
+
+static gboolean pacing_tick(void)
+{
+	gint64 late = g_get_monotonic_time() - deadline;
+
+	if(late < 0)
+		late = 0;
+
+	stats.ticks++;
+	stats.total_late += late;
+	if(late > stats.max_late)
+		stats.max_late = late;
+
+	return tick_callback(NULL);
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+
+static gboolean timer_fd_ready(gint fd, GIOCondition condition, gpointer data)
+{
+	guint64 expirations;
+
+	if(read(fd, &expirations, sizeof(expirations)) == -1 && errno == EAGAIN)
+		return G_SOURCE_CONTINUE;
+
+	if(pacing_tick() == FALSE)
+		pacing_stop();
+
+	return G_SOURCE_CONTINUE;
+}
+
+#else
+
+static gboolean timeout_ready(gpointer data)
+{
+	source_id = 0;
+
+	if(pacing_tick() == FALSE)
+		pacing_stop();
+
+	return G_SOURCE_REMOVE;
+}
+
+#endif
+
+/* The callback is called at each deadline given by pacing_schedule(), */
+/* until it returns FALSE or pacing_stop() is called                   */
+gboolean pacing_start(GSourceFunc callback)
+{
+	pacing_stop();
+
+	memset(&stats, 0, sizeof(stats));
+	stats.start = g_get_monotonic_time();
+	tick_callback = callback;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timer_fd == -1)
+		return FALSE;
+
+	/* before the redraws, which would otherwise delay the deadlines */
+	source_id = g_unix_fd_add_full(G_PRIORITY_HIGH, timer_fd, G_IO_IN, timer_fd_ready, NULL, NULL);
+#endif
+
+	return TRUE;
+}
+
+/* deadline on the clock of g_get_monotonic_time(), in us */
+void pacing_schedule(gint64 time)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec spec;
+
+	deadline = time;
+	if(timer_fd == -1)
+		return;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = time / G_USEC_PER_SEC;
+	spec.it_value.tv_nsec = (time % G_USEC_PER_SEC) * 1000;
+
+	/* a zero value would disarm the timer */
+	if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+
+	if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+		perror("timerfd_settime");
+#else
+	gint64 delay = time - g_get_monotonic_time();
+
+	deadline = time;
+	if(tick_callback == NULL)
+		return;
+
+	if(source_id != 0)
+		g_source_remove(source_id);
+
+	if(delay <= 0)
+		source_id = g_idle_add_full(G_PRIORITY_HIGH, timeout_ready, NULL, NULL);
+	else
+		source_id = g_timeout_add_full(G_PRIORITY_HIGH, (delay + 999) / 1000, timeout_ready, NULL, NULL);
+#endif
+}
+
+void pacing_stop(void)
+{
+	if(tick_callback != NULL)
+		stats.end = g_get_monotonic_time();
+
+	if(source_id != 0)
+		g_source_remove(source_id);
+	source_id = 0;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if(timer_fd != -1)
+		close(timer_fd);
+	timer_fd = -1;
+#endif
+
+	tick_callback = NULL;
+}
+
+void pacing_get_statistics(pacing_stats_t *result)
+{
+	*result = stats;
+	if(tick_callback != NULL)
+		result->end = g_get_monotonic_time();
+}
+
+void pacing_append_statistics(GString *string)
+{
+	if(stats.ticks == 0)
+		return;
+
+	g_string_append_printf(string,
+	                       _("Paced transfer:\n"
+	                         "  Deadlines: %" G_GUINT64_FORMAT " in %.3f s\n"
+	                         "  Jitter: %.1f us average, %" G_GINT64_FORMAT " us max\n"),
+	                       stats.ticks,
+	                       (gdouble)((tick_callback != NULL ? g_get_monotonic_time() : stats.end) - stats.start) / G_USEC_PER_SEC,
+	                       (gdouble)stats.total_late / stats.ticks, stats.max_late);
+}
@@ -0,0 +1,35 @@
+/***********************************************************************/
+/* pacing.h                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Microsecond deadlines for the paced file transfers             */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef PACING_H_
+#define PACING_H_
+
+#define PACING_MAX_LATE 100000      /* in us, later deadlines are not caught up */
+
+typedef struct
+{
+	guint64 ticks;
+	gint64 total_late;                /* in us */
+	gint64 max_late;
+	gint64 start;
+	gint64 end;
+} pacing_stats_t;
+
+gboolean pacing_start(GSourceFunc);
+void pacing_schedule(gint64);
+void pacing_stop(void);
+void pacing_get_statistics(pacing_stats_t *);
+void pacing_append_statistics(GString *);
+
+#endif
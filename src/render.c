@@ -0,0 +1,173 @@
+/***********************************************************************/
+/* render.c                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Frame-rate limited, coalesced feeding of the VTE widget        */
+/*                                                                     */
+/*      Received data is accumulated and handed to VTE at most once    */
+/*      per frame of the widget frame clock (and at most render_fps    */
+/*      times per second), instead of once per read() chunk.           */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <vte/vte.h>
+#include <glib.h>
+
+#include "term_config.h"
+#include "serial.h"
+#include "render.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+static GtkWidget *terminal = NULL;
+static GByteArray *pending = NULL;
+static guint tick_id = 0;
+static gint64 last_feed_time = 0;
+static gboolean clear_pending = FALSE;
+
+/* Statistics */
+static gint64 window_start = 0;
+static guint window_feeds = 0;
+static guint window_chunks = 0;
+static guint64 window_bytes = 0;
+static gdouble feeds_per_second = 0;
+static gdouble chunks_per_second = 0;
+static gdouble bytes_per_second = 0;
+static guint64 total_feeds = 0;
+static guint64 total_chunks = 0;
+static guint64 total_bytes = 0;
+static guint64 clears_requested = 0;
+static guint64 clears_done = 0;
+
+extern struct configuration_port config;
+
+static void update_statistics(gint64 now)
+{
+	gint64 elapsed = now - window_start;
+
+	if(elapsed < G_USEC_PER_SEC)
+		return;
+
+	feeds_per_second = (gdouble)window_feeds * G_USEC_PER_SEC / elapsed;
+	chunks_per_second = (gdouble)window_chunks * G_USEC_PER_SEC / elapsed;
+	bytes_per_second = (gdouble)window_bytes * G_USEC_PER_SEC / elapsed;
+
+	window_start = now;
+	window_feeds = 0;
+	window_chunks = 0;
+	window_bytes = 0;
+}
+
+static void feed_pending(gint64 now)
+{
+	if(clear_pending)
+	{
+		vte_terminal_reset(VTE_TERMINAL(terminal), TRUE, TRUE);
+		clear_pending = FALSE;
+		clears_done++;
+		last_feed_time = now;
+	}
+
+	if(pending->len == 0)
+		return;
+
+	vte_terminal_feed(VTE_TERMINAL(terminal), (gchar *)pending->data, pending->len);
+
+	window_feeds++;
+	window_bytes += pending->len;
+	total_feeds++;
+	total_bytes += pending->len;
+	update_statistics(now);
+
+	g_byte_array_set_size(pending, 0);
+	last_feed_time = now;
+}
+
+static gboolean render_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data)
+{
+	gint64 now = gdk_frame_clock_get_frame_time(clock);
+
+	/* 3/4 of the period: a frame timestamped a little early must not */
+	/* wait for the next one, which would halve a rate equal to the   */
+	/* refresh rate of the display                                    */
+	if(config.render_fps > 0 && now - last_feed_time < G_USEC_PER_SEC * 3 / (4 * config.render_fps))
+		return G_SOURCE_CONTINUE;
+
+	feed_pending(now);
+	tick_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+void render_init(GtkWidget *widget)
+{
+	terminal = widget;
+	pending = g_byte_array_sized_new(BUFFER_RECEPTION);
+	window_start = g_get_monotonic_time();
+}
+
+void render_feed(const gchar *string, guint size)
+{
+	if(size == 0)
+		return;
+
+	window_chunks++;
+	total_chunks++;
+
+	g_byte_array_append(pending, (const guint8 *)string, size);
+
+	/* Do not let the backlog grow while the widget is not drawn */
+	if(pending->len >= RENDER_MAX_PENDING)
+	{
+		render_flush();
+		return;
+	}
+
+	if(tick_id == 0)
+		tick_id = gtk_widget_add_tick_callback(terminal, render_tick, NULL, NULL);
+}
+
+void render_flush(void)
+{
+	if(pending == NULL)
+		return;
+
+	feed_pending(g_get_monotonic_time());
+}
+
+/* The terminal is only reset at the next frame, before what is received */
+/* afterwards: a burst of clear requests costs a single reset            */
+void render_clear(void)
+{
+	if(pending == NULL)
+		return;
+
+	g_byte_array_set_size(pending, 0);
+	clear_pending = TRUE;
+	clears_requested++;
+
+	if(tick_id == 0)
+		tick_id = gtk_widget_add_tick_callback(terminal, render_tick, NULL, NULL);
+}
+
+void render_append_statistics(GString *string)
+{
+	update_statistics(g_get_monotonic_time());
+
+	g_string_append_printf(string,
+	                       _("Terminal rendering:\n"
+	                         "  Feeds: %.1f/s for %.1f chunks/s (%.0f bytes/s)\n"
+	                         "  Average: %.1f bytes/feed, %.1f chunks/feed\n"
+	                         "  Clears: %" G_GUINT64_FORMAT " requested, %" G_GUINT64_FORMAT " done\n"),
+	                       feeds_per_second, chunks_per_second, bytes_per_second,
+	                       total_feeds ? (gdouble)total_bytes / total_feeds : 0.0,
+	                       total_feeds ? (gdouble)total_chunks / total_feeds : 0.0,
+	                       clears_requested, clears_done);
+}
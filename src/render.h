@@ -0,0 +1,27 @@
+/***********************************************************************/
+/* render.h                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Frame-rate limited, coalesced feeding of the VTE widget        */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#define DEFAULT_RENDER_FPS 60
+#define RENDER_MAX_PENDING (1024 * 1024)
+
+void render_init(GtkWidget *);
+void render_feed(const gchar *, guint);
+void render_flush(void);
+void render_clear(void);
+void render_append_statistics(GString *);
+
+#endif
@@ -0,0 +1,496 @@
+/***********************************************************************/
+/* rx_thread.c                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Dedicated serial port reader thread feeding the main loop      */
+/*      through a single-producer / single-consumer byte ring          */
+/*                                                                     */
+/*      The reader thread is the only one calling read() on the port.  */
+/*      It stores the data in a lock-free ring and wakes up the GTK    */
+/*      main loop, which consumes the ring in batches. A UI stall      */
+/*      therefore only fills the ring instead of the kernel buffer.    */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "term_config.h"
+#include "serial.h"
+#include "rx_thread.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+typedef struct
+{
+	gchar *data;
+	guint size;                  /* power of two */
+	guint mask;
+	volatile gint head;          /* only written by the reader thread */
+	volatile gint tail;          /* only written by the main loop */
+} rx_ring_t;
+
+static rx_ring_t ring;
+
+/* Ring offsets where a frame starts, as seen by the reader thread */
+static guint frame_breaks[RX_FRAME_BREAKS];
+static volatile gint breaks_head;   /* only written by the reader thread */
+static volatile gint breaks_tail;   /* only written by the main loop */
+static frame_detector_t frames;     /* only used by the reader thread */
+static GThread *reader = NULL;
+static int port_fd = -1;
+
+/* [0] is read, [1] is written. Both are the same fd with eventfd */
+static int wakeup_main[2] = {-1, -1};
+static int wakeup_reader[2] = {-1, -1};
+static volatile gint main_wakeup_pending = 0;
+static volatile gint reader_stop = 0;
+static volatile gint reader_failed = 0;
+static volatile gint reader_running = 0;   /* reader_id is set */
+static volatile gint reader_done = 0;
+static pthread_t reader_id;
+static guint wakeup_watch;
+static guint rearm_handler = 0;
+
+static rx_data_func data_callback = NULL;
+static rx_frame_func frame_callback = NULL;
+static rx_error_func error_callback = NULL;
+
+extern struct configuration_port config;
+
+/* Statistics, only updated when they change so a mutex is cheap enough */
+static GMutex stats_mutex;
+static guint ring_high_water = 0;
+static guint64 ring_overflows = 0;
+static guint64 bytes_dropped = 0;
+static guint64 bytes_received = 0;
+static guint64 breaks_lost = 0;
+
+static gboolean wakeup_open(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fds[1] = fds[0];
+	return fds[0] != -1;
+#else
+	if(pipe(fds) == -1)
+		return FALSE;
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return TRUE;
+#endif
+}
+
+static void wakeup_close(int fds[2])
+{
+	if(fds[0] != -1)
+		close(fds[0]);
+	if(fds[1] != -1 && fds[1] != fds[0])
+		close(fds[1]);
+	fds[0] = -1;
+	fds[1] = -1;
+}
+
+static void wakeup_signal(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	guint64 one = 1;
+
+	if(write(fds[1], &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("eventfd");
+#else
+	gchar one = 1;
+
+	if(write(fds[1], &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("pipe");
+#endif
+}
+
+static void wakeup_drain(int fds[2])
+{
+	gchar dummy[64];
+
+	while(read(fds[0], dummy, sizeof(dummy)) > 0)
+		;
+}
+
+static void notify_main_loop(void)
+{
+	/* Only one pending wakeup at a time: the main loop consumes */
+	/* everything available when it runs                         */
+	if(g_atomic_int_compare_and_exchange(&main_wakeup_pending, 0, 1))
+		wakeup_signal(wakeup_main);
+}
+
+static void update_high_water(guint used)
+{
+	if(used <= ring_high_water)
+		return;
+
+	g_mutex_lock(&stats_mutex);
+	if(used > ring_high_water)
+		ring_high_water = used;
+	g_mutex_unlock(&stats_mutex);
+}
+
+static void drop_input(void)
+{
+	static gchar scratch[BUFFER_RECEPTION];
+	gint bytes_read;
+
+	/* The ring is full: drain the port anyway so that the loss is */
+	/* accounted for here instead of in the kernel driver          */
+	bytes_read = read(port_fd, scratch, sizeof(scratch));
+	if(bytes_read <= 0)
+		return;
+
+	g_mutex_lock(&stats_mutex);
+	ring_overflows++;
+	bytes_dropped += bytes_read;
+	g_mutex_unlock(&stats_mutex);
+}
+
+/* The boundary must be pushed before the data after it is published */
+static void push_frame_break(guint offset)
+{
+	guint head = g_atomic_int_get(&breaks_head);
+
+	if(head - (guint)g_atomic_int_get(&breaks_tail) == RX_FRAME_BREAKS)
+	{
+		g_mutex_lock(&stats_mutex);
+		breaks_lost++;
+		g_mutex_unlock(&stats_mutex);
+		return;
+	}
+
+	frame_breaks[head % RX_FRAME_BREAKS] = offset;
+	g_atomic_int_set(&breaks_head, head + 1);
+}
+
+/* Only there to make the blocking read() return EINTR */
+static void interrupt_handler(int signal_number)
+{
+}
+
+static void catch_interrupt(void)
+{
+	static gboolean caught = FALSE;
+	struct sigaction action;
+
+	if(caught)
+		return;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = interrupt_handler;
+	sigemptyset(&action.sa_mask);
+	/* no SA_RESTART */
+	sigaction(RX_THREAD_SIGNAL, &action, NULL);
+
+	caught = TRUE;
+}
+
+static gpointer reader_thread(gpointer data)
+{
+	struct pollfd fds[2];
+	guint head, tail, used, offset, space;
+	gint bytes_read;
+
+	reader_id = pthread_self();
+	g_atomic_int_set(&reader_running, 1);
+
+	fds[0].fd = port_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakeup_reader[0];
+	fds[1].events = POLLIN;
+
+	head = g_atomic_int_get(&ring.head);
+
+	while(!g_atomic_int_get(&reader_stop))
+	{
+		if(poll(fds, 2, -1) == -1)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if(fds[1].revents)
+			break;
+
+		if(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+		{
+			g_atomic_int_set(&reader_failed, 1);
+			break;
+		}
+
+		tail = g_atomic_int_get(&ring.tail);
+		used = head - tail;
+
+		if(used == ring.size)
+		{
+			drop_input();
+			notify_main_loop();
+			continue;
+		}
+
+		/* read straight into the free contiguous part of the ring */
+		offset = head & ring.mask;
+		space = MIN(ring.size - used, ring.size - offset);
+
+		bytes_read = read(port_fd, ring.data + offset, space);
+		if(bytes_read > 0)
+		{
+			/* timed here, close to the arrival of the data */
+			if(frame_detector_update(&frames, g_get_monotonic_time(), bytes_read))
+				push_frame_break(head);
+
+			head += bytes_read;
+			g_atomic_int_set(&ring.head, head);
+			update_high_water(head - tail);
+			notify_main_loop();
+		}
+		else if(bytes_read == 0)
+		{
+			/* readable but nothing to read: the device is gone */
+			g_atomic_int_set(&reader_failed, 1);
+			break;
+		}
+		else if(errno != EAGAIN && errno != EINTR)
+		{
+			perror(config.port);
+			g_atomic_int_set(&reader_failed, 1);
+			break;
+		}
+	}
+
+	notify_main_loop();
+	g_atomic_int_set(&reader_done, 1);
+
+	return NULL;
+}
+
+static gboolean rearm_dispatch(gpointer data)
+{
+	rearm_handler = 0;
+	g_atomic_int_set(&main_wakeup_pending, 0);
+	notify_main_loop();
+
+	return FALSE;
+}
+
+static gboolean rx_thread_dispatch(GIOChannel *src, GIOCondition cond, gpointer data)
+{
+	guint head, tail, offset, length, total = 0, next;
+	gint64 start;
+
+	wakeup_drain(wakeup_main);
+	g_atomic_int_set(&main_wakeup_pending, 0);
+
+	head = g_atomic_int_get(&ring.head);
+	tail = g_atomic_int_get(&ring.tail);
+	start = g_get_monotonic_time();
+
+	while(tail != head)
+	{
+		/* Same budget as Lis_port(): leave the rest for after the */
+		/* lower priority sources (drawing) have run. Keeping the  */
+		/* wakeup flagged as pending stops the reader from waking  */
+		/* the main loop up in the meantime                        */
+		if(total >= RECEPTION_BUDGET_BYTES || g_get_monotonic_time() - start >= RECEPTION_BUDGET_TIME)
+		{
+			g_atomic_int_set(&main_wakeup_pending, 1);
+			if(rearm_handler == 0)
+				rearm_handler = g_idle_add(rearm_dispatch, NULL);
+			break;
+		}
+
+		offset = tail & ring.mask;
+		length = MIN(head - tail, ring.size - offset);
+
+		/* stop at the next frame boundary */
+		if((guint)breaks_tail != (guint)g_atomic_int_get(&breaks_head))
+		{
+			next = frame_breaks[(guint)breaks_tail % RX_FRAME_BREAKS];
+			if(next == tail)
+			{
+				frame_callback();
+				g_atomic_int_set(&breaks_tail, breaks_tail + 1);
+				continue;
+			}
+			length = MIN(length, next - tail);
+		}
+
+		data_callback(ring.data + offset, length);
+
+		/* The callback may have closed the port */
+		if(reader == NULL)
+			return FALSE;
+
+		tail += length;
+		g_atomic_int_set(&ring.tail, tail);
+		bytes_received += length;
+		total += length;
+	}
+
+	if(g_atomic_int_get(&reader_failed))
+	{
+		if(error_callback != NULL)
+			error_callback();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean rx_thread_start(int fd, guint ring_size_kb, const frame_detector_t *frame_detector,
+                         rx_data_func data_func, rx_frame_func frame_func, rx_error_func error_func)
+{
+	GIOChannel *channel;
+	guint size;
+
+	rx_thread_stop();
+
+	ring_size_kb = CLAMP(ring_size_kb, RX_RING_MIN_SIZE, RX_RING_MAX_SIZE);
+
+	/* round the ring up to a power of two so indexes can be masked */
+	size = 1;
+	while(size < ring_size_kb * 1024)
+		size <<= 1;
+
+	ring.data = g_malloc(size);
+	ring.size = size;
+	ring.mask = size - 1;
+	ring.head = 0;
+	ring.tail = 0;
+
+	if(!wakeup_open(wakeup_main))
+	{
+		perror("wakeup");
+		g_free(ring.data);
+		ring.data = NULL;
+		return FALSE;
+	}
+	if(!wakeup_open(wakeup_reader))
+	{
+		perror("wakeup");
+		wakeup_close(wakeup_main);
+		g_free(ring.data);
+		ring.data = NULL;
+		return FALSE;
+	}
+
+	port_fd = fd;
+	data_callback = data_func;
+	frame_callback = frame_func;
+	error_callback = error_func;
+	frames = *frame_detector;
+	breaks_head = 0;
+	breaks_tail = 0;
+	main_wakeup_pending = 0;
+	reader_stop = 0;
+	reader_failed = 0;
+	reader_running = 0;
+	reader_done = 0;
+
+	g_mutex_lock(&stats_mutex);
+	ring_high_water = 0;
+	ring_overflows = 0;
+	bytes_dropped = 0;
+	breaks_lost = 0;
+	g_mutex_unlock(&stats_mutex);
+	bytes_received = 0;
+
+	channel = g_io_channel_unix_new(wakeup_main[0]);
+	wakeup_watch = g_io_add_watch_full(channel, 10, G_IO_IN,
+	                                   (GIOFunc)rx_thread_dispatch,
+	                                   NULL, NULL);
+	g_io_channel_unref(channel);
+
+	catch_interrupt();
+	reader = g_thread_new("serial-reader", reader_thread, NULL);
+
+	return TRUE;
+}
+
+void rx_thread_stop(void)
+{
+	if(reader == NULL)
+		return;
+
+	g_atomic_int_set(&reader_stop, 1);
+	wakeup_signal(wakeup_reader);
+
+	/* A blocking read() waiting for VMIN bytes does not see the wakeup. */
+	/* It is interrupted until the thread is out, as the signal can come */
+	/* just before the read() starts                                     */
+	while(!g_atomic_int_get(&reader_done))
+	{
+		if(g_atomic_int_get(&reader_running))
+			pthread_kill(reader_id, RX_THREAD_SIGNAL);
+		g_usleep(RX_THREAD_INTERRUPT_TIME);
+	}
+	g_thread_join(reader);
+	reader = NULL;
+
+	g_source_remove(wakeup_watch);
+	if(rearm_handler != 0)
+		g_source_remove(rearm_handler);
+	rearm_handler = 0;
+	wakeup_close(wakeup_main);
+	wakeup_close(wakeup_reader);
+
+	g_free(ring.data);
+	ring.data = NULL;
+	port_fd = -1;
+}
+
+gboolean rx_thread_running(void)
+{
+	return reader != NULL;
+}
+
+void rx_thread_append_statistics(GString *string)
+{
+	if(ring.size == 0)
+	{
+		g_string_append(string, _("Receive thread: not used\n"));
+		return;
+	}
+
+	g_mutex_lock(&stats_mutex);
+	g_string_append_printf(string,
+	                       _("Receive thread: %s\n"
+	                         "  Ring size: %u KiB\n"
+	                         "  Ring high-water mark: %u bytes (%u%%)\n"
+	                         "  Ring overflows: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes dropped)\n"
+	                         "  Bytes received: %" G_GUINT64_FORMAT "\n"
+	                         "  Frame boundaries lost: %" G_GUINT64_FORMAT "\n"),
+	                       reader != NULL ? _("running") : _("stopped"),
+	                       ring.size / 1024,
+	                       ring_high_water,
+	                       (guint)((guint64)ring_high_water * 100 / ring.size),
+	                       ring_overflows, bytes_dropped,
+	                       bytes_received, breaks_lost);
+	g_mutex_unlock(&stats_mutex);
+}
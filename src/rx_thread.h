@@ -0,0 +1,34 @@
+/***********************************************************************/
+/* rx_thread.h                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Dedicated serial port reader thread feeding the main loop      */
+/*      through a single-producer / single-consumer byte ring          */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef RX_THREAD_H_
+#define RX_THREAD_H_
+
+#define RX_RING_MIN_SIZE 16          /* in KiB */
+#define RX_RING_MAX_SIZE (512 * 1024) /* in KiB */
+#define RX_FRAME_BREAKS 1024          /* frame boundaries not dispatched yet */
+#define RX_THREAD_SIGNAL SIGRTMIN     /* interrupts a blocking read() */
+#define RX_THREAD_INTERRUPT_TIME 1000 /* between two signals, in us */
+
+typedef void (*rx_data_func)(gchar *, gint);
+typedef void (*rx_frame_func)(void);
+typedef void (*rx_error_func)(void);
+
+gboolean rx_thread_start(int, guint, const frame_detector_t *, rx_data_func, rx_frame_func, rx_error_func);
+void rx_thread_stop(void);
+gboolean rx_thread_running(void);
+void rx_thread_append_statistics(GString *);
+
+#endif
@@ -0,0 +1,810 @@
+/***********************************************************************/
+/* script.c                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Macro scripts: send, sleep, expect, loops and counters         */
+/*                                                                     */
+/*      A macro whose action starts with "#!" is a script: commands    */
+/*      separated by ';' or new lines, compiled once when the macros   */
+/*      are loaded or saved. It runs from the main loop, a command     */
+/*      after the other, and waits on timers or on the received data   */
+/*      without blocking the interface.                                */
+/*                                                                     */
+/*        send "text" 0x0D0A $var crc16 crc32                          */
+/*        sleep 200ms | 1.5s | 500us                                   */
+/*        expect "login:" [timeout]                                    */
+/*        repeat [count] ... end                                       */
+/*        set var value, add var value                                 */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <string.h>
+
+#include "serial.h"
+#include "interface.h"
+#include "macros.h"
+#include "crc.h"
+#include "script.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+enum
+{
+	OP_SEND, OP_SLEEP, OP_EXPECT, OP_REPEAT, OP_END, OP_SET, OP_ADD
+};
+
+/* Pieces of the data of a send */
+enum
+{
+	PART_BYTES, PART_VARIABLE, PART_CRC16, PART_CRC32
+};
+
+typedef struct
+{
+	gint type;
+	guint offset;       /* in the bytes of the script, or variable */
+	guint length;
+}
+script_part_t;
+
+typedef struct
+{
+	gint type;
+	gint64 value;       /* in us for the times, -1: repeat forever */
+	guint variable;
+	guint first;        /* send: parts, expect: bytes of the pattern */
+	guint count;
+	guint target;       /* repeat: after its end, end: its repeat */
+	guint depth;
+	gchar *text;        /* expect: the pattern as written */
+}
+script_op_t;
+
+struct script
+{
+	GArray *ops;
+	GArray *parts;
+	GByteArray *bytes;
+	GArray *fallback;   /* expect: where to go back to after a mismatch */
+	GPtrArray *variables;
+};
+
+/* The running script */
+static script_t *running = NULL;
+static gchar *running_name = NULL;
+static guint pc;
+static gint64 *values = NULL;
+static gint64 counters[SCRIPT_MAX_DEPTH];
+static gint64 deadline;             /* of the last sleep, in us */
+static gint64 started;
+static guint source_id = 0;         /* timer, timeout or idle */
+static gboolean expecting = FALSE;
+static guint matched;
+static GByteArray *pending = NULL;  /* not taken by the transmit queue yet */
+static guint pending_offset;
+static guint sends;
+static guint64 bytes_sent;
+
+
+/*********************************************************************/
+/* Compilation                                                       */
+/*********************************************************************/
+
+static void script_error(gchar **error, guint command, const gchar *format, ...)
+{
+	va_list args;
+	gchar *reason;
+
+	va_start(args, format);
+	reason = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	*error = g_strdup_printf(_("Script error in command %u: %s"), command, reason);
+	g_free(reason);
+}
+
+/* Splits a command in words: a string keeps its leading '"' */
+static gboolean next_command(const gchar **script, GPtrArray *words)
+{
+	const gchar *p = *script;
+	const gchar *start;
+
+	while(*p != 0)
+	{
+		if(*p == ';' || *p == '\n')
+		{
+			p++;
+			break;
+		}
+		else if(g_ascii_isspace(*p))
+			p++;
+		else if(*p == '"')
+		{
+			start = p++;
+			while(*p != 0 && *p != '"')
+			{
+				if(*p == '\\' && p[1] != 0)
+					p++;
+				p++;
+			}
+			if(*p == 0)
+			{
+				*script = p;
+				return FALSE;
+			}
+			g_ptr_array_add(words, g_strndup(start, p - start));
+			p++;
+		}
+		else
+		{
+			start = p;
+			while(*p != 0 && *p != ';' && *p != '\n' && *p != '"' && !g_ascii_isspace(*p))
+				p++;
+			g_ptr_array_add(words, g_strndup(start, p - start));
+		}
+	}
+
+	*script = p;
+	return TRUE;
+}
+
+static gboolean is_name(const gchar *name)
+{
+	if(!g_ascii_isalpha(*name) && *name != '_')
+		return FALSE;
+	while(g_ascii_isalnum(*name) || *name == '_')
+		name++;
+
+	return *name == 0;
+}
+
+static guint find_variable(script_t *script, const gchar *name, gsize length)
+{
+	guint i;
+
+	for(i = 0; i < script->variables->len; i++)
+	{
+		if(strlen(script->variables->pdata[i]) == length && !strncmp(script->variables->pdata[i], name, length))
+			return i;
+	}
+	g_ptr_array_add(script->variables, g_strndup(name, length));
+
+	return i;
+}
+
+/* Into the bytes of the script, with the escapes of the macros */
+static guint add_text(script_t *script, const gchar *text, gsize length)
+{
+	gchar *string, *data;
+	guint offset = script->bytes->len;
+	gint size;
+
+	string = g_strndup(text, length);
+	data = g_malloc(length + 1);
+	size = macro_decode(string, data);
+	g_byte_array_append(script->bytes, (guint8 *)data, size);
+	g_free(data);
+	g_free(string);
+
+	return offset;
+}
+
+static void add_part(script_t *script, gint type, guint offset, guint length)
+{
+	script_part_t part;
+
+	part.type = type;
+	part.offset = offset;
+	part.length = length;
+	g_array_append_val(script->parts, part);
+}
+
+static void add_bytes(script_t *script, const gchar *text, gsize length)
+{
+	guint offset;
+
+	if(length == 0)
+		return;
+
+	offset = add_text(script, text, length);
+	add_part(script, PART_BYTES, offset, script->bytes->len - offset);
+}
+
+/* "$name" is the value of a variable, "$$" a '$' */
+static void add_string(script_t *script, const gchar *string)
+{
+	const gchar *start = string, *p = string, *name;
+
+	while(*p != 0)
+	{
+		if(*p == '$' && p[1] == '$')
+		{
+			add_bytes(script, start, p + 1 - start);
+			p += 2;
+			start = p;
+		}
+		else if(*p == '$' && (g_ascii_isalpha(p[1]) || p[1] == '_'))
+		{
+			add_bytes(script, start, p - start);
+			name = ++p;
+			while(g_ascii_isalnum(*p) || *p == '_')
+				p++;
+			add_part(script, PART_VARIABLE, find_variable(script, name, p - name), 0);
+			start = p;
+		}
+		else
+			p++;
+	}
+
+	add_bytes(script, start, p - start);
+}
+
+static gboolean add_hex(script_t *script, const gchar *word)
+{
+	guint8 byte;
+	guint offset = script->bytes->len;
+
+	word += 2;
+	if(*word == 0 || strlen(word) % 2 != 0)
+		return FALSE;
+
+	for(; *word != 0; word += 2)
+	{
+		if(!g_ascii_isxdigit(word[0]) || !g_ascii_isxdigit(word[1]))
+			return FALSE;
+		byte = (g_ascii_xdigit_value(word[0]) << 4) | g_ascii_xdigit_value(word[1]);
+		g_byte_array_append(script->bytes, &byte, 1);
+	}
+	add_part(script, PART_BYTES, offset, script->bytes->len - offset);
+
+	return TRUE;
+}
+
+/* In ms without a unit */
+static gboolean parse_time(const gchar *word, gint64 *time)
+{
+	gchar *end;
+	gdouble value;
+
+	value = g_ascii_strtod(word, &end);
+	if(end == word || value < 0)
+		return FALSE;
+
+	if(*end == 0 || !strcmp(end, "ms"))
+		*time = value * 1000;
+	else if(!strcmp(end, "s"))
+		*time = value * G_USEC_PER_SEC;
+	else if(!strcmp(end, "us"))
+		*time = value;
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+static gboolean parse_integer(const gchar *word, gint64 *value)
+{
+	gchar *end;
+
+	*value = g_ascii_strtoll(word, &end, 0);
+
+	return end != word && *end == 0;
+}
+
+/* Where the comparison starts again after a mismatch (KMP) */
+static void add_fallback(script_t *script, guint offset, guint length)
+{
+	const guint8 *pattern = script->bytes->data + offset;
+	guint *fallback;
+	guint i, k;
+
+	g_array_set_size(script->fallback, script->bytes->len);
+	fallback = &g_array_index(script->fallback, guint, offset);
+
+	fallback[0] = 0;
+	for(i = 1; i < length; i++)
+	{
+		k = fallback[i - 1];
+		while(k > 0 && pattern[i] != pattern[k])
+			k = fallback[k - 1];
+		if(pattern[i] == pattern[k])
+			k++;
+		fallback[i] = k;
+	}
+}
+
+static gboolean compile_command(script_t *script, GPtrArray *words, guint command,
+                                GArray *loops, gchar **error)
+{
+	const gchar *name = words->pdata[0];
+	const gchar *word;
+	script_op_t op;
+	guint i;
+
+	memset(&op, 0, sizeof(op));
+
+	if(name[0] == '"')
+	{
+		script_error(error, command, _("a command is expected instead of a string"));
+		return FALSE;
+	}
+
+	if(!g_ascii_strcasecmp(name, "send"))
+	{
+		op.type = OP_SEND;
+		op.first = script->parts->len;
+		if(words->len < 2)
+		{
+			script_error(error, command, _("nothing to send"));
+			return FALSE;
+		}
+		for(i = 1; i < words->len; i++)
+		{
+			word = words->pdata[i];
+			if(word[0] == '"')
+				add_string(script, word + 1);
+			else if(word[0] == '$' && is_name(word + 1))
+				add_part(script, PART_VARIABLE, find_variable(script, word + 1, strlen(word + 1)), 0);
+			else if(!g_ascii_strcasecmp(word, "crc16"))
+				add_part(script, PART_CRC16, 0, 0);
+			else if(!g_ascii_strcasecmp(word, "crc32"))
+				add_part(script, PART_CRC32, 0, 0);
+			else if(g_ascii_strncasecmp(word, "0x", 2) || !add_hex(script, word))
+			{
+				script_error(error, command, _("cannot send \"%s\""), word);
+				return FALSE;
+			}
+		}
+		op.count = script->parts->len - op.first;
+	}
+	else if(!g_ascii_strcasecmp(name, "sleep"))
+	{
+		op.type = OP_SLEEP;
+		if(words->len != 2 || !parse_time(words->pdata[1], &op.value))
+		{
+			script_error(error, command, _("sleep needs a time, like 200ms or 1.5s"));
+			return FALSE;
+		}
+	}
+	else if(!g_ascii_strcasecmp(name, "expect"))
+	{
+		op.type = OP_EXPECT;
+		op.value = (gint64)SCRIPT_EXPECT_TIMEOUT * 1000;
+		word = words->len > 1 ? words->pdata[1] : "";
+		if(words->len > 3 || word[0] != '"' || word[1] == 0
+		        || (words->len == 3 && !parse_time(words->pdata[2], &op.value)))
+		{
+			script_error(error, command, _("expect needs a string and an optional timeout"));
+			return FALSE;
+		}
+		op.first = add_text(script, word + 1, strlen(word + 1));
+		op.count = script->bytes->len - op.first;
+		if(op.count == 0)
+		{
+			script_error(error, command, _("expect needs a string and an optional timeout"));
+			return FALSE;
+		}
+		add_fallback(script, op.first, op.count);
+		op.text = g_strdup(word + 1);
+	}
+	else if(!g_ascii_strcasecmp(name, "repeat"))
+	{
+		op.type = OP_REPEAT;
+		op.value = -1;
+		if(words->len > 2 || (words->len == 2 && (!parse_integer(words->pdata[1], &op.value) || op.value < 0)))
+		{
+			script_error(error, command, _("repeat needs a count, or nothing to repeat forever"));
+			return FALSE;
+		}
+		if(loops->len == SCRIPT_MAX_DEPTH)
+		{
+			script_error(error, command, _("too many loops inside each other"));
+			return FALSE;
+		}
+		op.depth = loops->len;
+		g_array_append_val(loops, script->ops->len);
+	}
+	else if(!g_ascii_strcasecmp(name, "end"))
+	{
+		op.type = OP_END;
+		if(words->len != 1 || loops->len == 0)
+		{
+			script_error(error, command, _("end without repeat"));
+			return FALSE;
+		}
+		op.target = g_array_index(loops, guint, loops->len - 1);
+		op.depth = loops->len - 1;
+		g_array_set_size(loops, loops->len - 1);
+		g_array_index(script->ops, script_op_t, op.target).target = script->ops->len + 1;
+	}
+	else if(!g_ascii_strcasecmp(name, "set") || !g_ascii_strcasecmp(name, "add"))
+	{
+		op.type = g_ascii_strcasecmp(name, "set") ? OP_ADD : OP_SET;
+		if(words->len != 3 || !is_name(words->pdata[1]) || !parse_integer(words->pdata[2], &op.value))
+		{
+			script_error(error, command, _("%s needs a variable and a number"), name);
+			return FALSE;
+		}
+		op.variable = find_variable(script, words->pdata[1], strlen(words->pdata[1]));
+	}
+	else
+	{
+		script_error(error, command, _("unknown command \"%s\""), name);
+		return FALSE;
+	}
+
+	g_array_append_val(script->ops, op);
+	return TRUE;
+}
+
+/* The text after SCRIPT_PREFIX, NULL and an error message if it is wrong */
+script_t *script_compile(const gchar *text, gchar **error)
+{
+	script_t *script;
+	GPtrArray *words;
+	GArray *loops;
+	guint command = 0;
+	gboolean ok = TRUE;
+
+	script = g_new0(script_t, 1);
+	script->ops = g_array_new(FALSE, FALSE, sizeof(script_op_t));
+	script->parts = g_array_new(FALSE, FALSE, sizeof(script_part_t));
+	script->bytes = g_byte_array_new();
+	script->fallback = g_array_new(FALSE, TRUE, sizeof(guint));
+	script->variables = g_ptr_array_new_with_free_func(g_free);
+
+	words = g_ptr_array_new_with_free_func(g_free);
+	loops = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	while(ok && *text != 0)
+	{
+		g_ptr_array_set_size(words, 0);
+		command++;
+		if(!next_command(&text, words))
+		{
+			script_error(error, command, _("unterminated string"));
+			ok = FALSE;
+		}
+		else if(words->len != 0)
+			ok = compile_command(script, words, command, loops, error);
+		else
+			command--;
+	}
+
+	if(ok && loops->len != 0)
+	{
+		script_error(error, command, _("repeat without end"));
+		ok = FALSE;
+	}
+	if(ok && script->ops->len == 0)
+	{
+		*error = g_strdup(_("The script is empty"));
+		ok = FALSE;
+	}
+
+	g_ptr_array_free(words, TRUE);
+	g_array_free(loops, TRUE);
+
+	if(!ok)
+	{
+		script_free(script);
+		return NULL;
+	}
+
+	return script;
+}
+
+
+/*********************************************************************/
+/* Execution                                                         */
+/*********************************************************************/
+
+static gboolean report(gpointer data)
+{
+	show_message(data, MSG_WRN);
+	g_free(data);
+
+	return FALSE;
+}
+
+/* A dialog cannot be run from the reception, it is shown later */
+static void script_finish(gint type, gchar *reason)
+{
+	gchar *msg;
+
+	if(source_id != 0)
+		g_source_remove(source_id);
+	source_id = 0;
+	expecting = FALSE;
+	if(pending != NULL)
+		g_byte_array_unref(pending);
+	pending = NULL;
+	running = NULL;
+	g_free(values);
+	values = NULL;
+
+	if(type == MSG_INF)
+	{
+		msg = g_strdup_printf(_("Macro \"%s\" %s: %u sends, %" G_GUINT64_FORMAT " bytes in %.1f s"),
+		                      running_name, reason != NULL ? reason : _("done"), sends, bytes_sent,
+		                      (g_get_monotonic_time() - started) / (gdouble)G_USEC_PER_SEC);
+		Put_temp_message(msg, 5000);
+		g_free(msg);
+	}
+	else if(type == MSG_WRN)
+		g_idle_add(report, g_strdup_printf(_("Macro \"%s\" stopped: %s"), running_name, reason));
+
+	g_free(reason);
+	g_free(running_name);
+	running_name = NULL;
+}
+
+static void script_continue(void);
+
+static gboolean script_resume(gpointer data)
+{
+	source_id = 0;
+	script_continue();
+
+	return FALSE;
+}
+
+static gboolean expect_timeout(gpointer data)
+{
+	script_op_t *op = &g_array_index(running->ops, script_op_t, pc - 1);
+
+	source_id = 0;
+	script_finish(MSG_WRN, g_strdup_printf(_("\"%s\" not received after %.1f s"),
+	                                       op->text, op->value / (gdouble)G_USEC_PER_SEC));
+
+	return FALSE;
+}
+
+static void build_send(script_op_t *op)
+{
+	script_part_t *part;
+	gchar number[32];
+	guint32 crc32;
+	guint16 crc16;
+	guint8 crc[4];
+	guint i;
+
+	pending = g_byte_array_new();
+	pending_offset = 0;
+
+	for(i = 0; i < op->count; i++)
+	{
+		part = &g_array_index(running->parts, script_part_t, op->first + i);
+		switch(part->type)
+		{
+		case PART_BYTES:
+			g_byte_array_append(pending, running->bytes->data + part->offset, part->length);
+			break;
+		case PART_VARIABLE:
+			g_snprintf(number, sizeof(number), "%" G_GINT64_FORMAT, values[part->offset]);
+			g_byte_array_append(pending, (guint8 *)number, strlen(number));
+			break;
+		case PART_CRC16:
+			/* of what comes before, most significant byte first */
+			crc16 = crc16_update(0, pending->data, pending->len);
+			crc[0] = crc16 >> 8;
+			crc[1] = crc16 & 0xff;
+			g_byte_array_append(pending, crc, 2);
+			break;
+		case PART_CRC32:
+			/* least significant byte first */
+			crc32 = ~crc32_update(0xFFFFFFFF, pending->data, pending->len);
+			crc[0] = crc32 & 0xff;
+			crc[1] = (crc32 >> 8) & 0xff;
+			crc[2] = (crc32 >> 16) & 0xff;
+			crc[3] = crc32 >> 24;
+			g_byte_array_append(pending, crc, 4);
+			break;
+		}
+	}
+}
+
+/* FALSE while the transmit queue cannot take all of it */
+static gboolean flush_send(void)
+{
+	gint written;
+
+	if(serial_port_fd == -1)
+	{
+		script_finish(MSG_WRN, g_strdup(_("the port is not open")));
+		return FALSE;
+	}
+
+	written = send_serial((gchar *)pending->data + pending_offset, pending->len - pending_offset);
+	if(written < 0)
+	{
+		script_finish(MSG_WRN, g_strdup(_("cannot write on the port")));
+		return FALSE;
+	}
+
+	pending_offset += written;
+	if(pending_offset < pending->len)
+	{
+		source_id = g_timeout_add(SCRIPT_RETRY, script_resume, NULL);
+		return FALSE;
+	}
+
+	sends++;
+	bytes_sent += pending->len;
+	g_byte_array_unref(pending);
+	pending = NULL;
+
+	return TRUE;
+}
+
+/* Runs until a command has to wait */
+static void script_continue(void)
+{
+	script_op_t *op;
+	gint64 now;
+	guint steps;
+
+	for(steps = 0; running != NULL; steps++)
+	{
+		if(pending != NULL && !flush_send())
+			return;
+
+		if(pc == running->ops->len)
+		{
+			script_finish(MSG_INF, NULL);
+			return;
+		}
+
+		/* an endless loop must not freeze the interface */
+		if(steps == SCRIPT_STEPS)
+		{
+			source_id = g_idle_add(script_resume, NULL);
+			return;
+		}
+
+		op = &g_array_index(running->ops, script_op_t, pc++);
+		switch(op->type)
+		{
+		case OP_SEND:
+			build_send(op);
+			break;
+
+		case OP_SLEEP:
+			/* from the end of the last sleep, so that the */
+			/* delays of the main loop do not add up       */
+			now = g_get_monotonic_time();
+			deadline += op->value;
+			if(deadline < now - 100000)
+				deadline = now;
+			if(deadline > now)
+			{
+				source_id = g_timeout_add_full(G_PRIORITY_HIGH, (deadline - now + 999) / 1000,
+				                               script_resume, NULL, NULL);
+				return;
+			}
+			break;
+
+		case OP_EXPECT:
+			expecting = TRUE;
+			matched = 0;
+			source_id = g_timeout_add(op->value / 1000, expect_timeout, NULL);
+			return;
+
+		case OP_REPEAT:
+			if(op->value == 0)
+				pc = op->target;
+			else
+				counters[op->depth] = op->value;
+			break;
+
+		case OP_END:
+			if(g_array_index(running->ops, script_op_t, op->target).value < 0 || --counters[op->depth] > 0)
+				pc = op->target + 1;
+			break;
+
+		case OP_SET:
+			values[op->variable] = op->value;
+			break;
+
+		case OP_ADD:
+			values[op->variable] += op->value;
+			break;
+		}
+	}
+}
+
+/* Pressing the shortcut of the running script again stops it */
+void script_run(script_t *script, const gchar *name)
+{
+	gboolean again = (script == running);
+
+	script_stop();
+	if(again)
+		return;
+
+	if(serial_port_fd == -1)
+	{
+		show_message(_("The port is not open"), MSG_ERR);
+		return;
+	}
+
+	running = script;
+	running_name = g_strdup(name);
+	values = g_new0(gint64, MAX(script->variables->len, 1));
+	pc = 0;
+	sends = 0;
+	bytes_sent = 0;
+	started = deadline = g_get_monotonic_time();
+
+	script_continue();
+}
+
+gboolean script_stop(void)
+{
+	if(running == NULL)
+		return FALSE;
+
+	script_finish(MSG_INF, g_strdup(_("stopped")));
+	return TRUE;
+}
+
+/* Looks for the pattern of the current expect */
+void script_received(const gchar *chars, guint length)
+{
+	script_op_t *op;
+	const guint8 *pattern;
+	guint *fallback;
+	guint8 c;
+	guint i;
+
+	for(i = 0; i < length && expecting; i++)
+	{
+		op = &g_array_index(running->ops, script_op_t, pc - 1);
+		pattern = running->bytes->data + op->first;
+		fallback = &g_array_index(running->fallback, guint, op->first);
+
+		c = (guint8)chars[i];
+		while(matched > 0 && c != pattern[matched])
+			matched = fallback[matched - 1];
+		if(c == pattern[matched])
+			matched++;
+
+		if(matched == op->count)
+		{
+			/* the next expect looks at what follows */
+			expecting = FALSE;
+			g_source_remove(source_id);
+			source_id = 0;
+			deadline = g_get_monotonic_time();
+			script_continue();
+		}
+	}
+}
+
+void script_free(script_t *script)
+{
+	guint i;
+
+	if(script == NULL)
+		return;
+
+	if(script == running)
+		script_finish(-1, NULL);
+
+	for(i = 0; i < script->ops->len; i++)
+		g_free(g_array_index(script->ops, script_op_t, i).text);
+	g_array_free(script->ops, TRUE);
+	g_array_free(script->parts, TRUE);
+	g_byte_array_unref(script->bytes);
+	g_array_free(script->fallback, TRUE);
+	g_ptr_array_free(script->variables, TRUE);
+	g_free(script);
+}
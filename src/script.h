@@ -0,0 +1,32 @@
+/***********************************************************************/
+/* script.h                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Macro scripts: send, sleep, expect, loops and counters         */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#define SCRIPT_PREFIX "#!"              /* an action starting with it is a script */
+#define SCRIPT_EXPECT_TIMEOUT 10000     /* default, in ms */
+#define SCRIPT_MAX_DEPTH 8              /* of the loops */
+#define SCRIPT_STEPS 1000               /* commands run before the main loop gets back */
+#define SCRIPT_RETRY 10                 /* when the transmit queue is full, in ms */
+
+typedef struct script script_t;
+
+script_t *script_compile(const gchar *, gchar **);
+void script_free(script_t *);
+void script_run(script_t *, const gchar *);
+gboolean script_stop(void);
+void script_received(const gchar *, guint);
+
+#endif
@@ -34,12 +34,19 @@
 #include <string.h>
 #include <errno.h>
 #include <pwd.h>
+#include <stdlib.h>
 
 #include "term_config.h"
 #include "serial.h"
 #include "interface.h"
 #include "files.h"
 #include "buffer.h"
+#include "rx_thread.h"
+#include "timestamp.h"
+#include "latency.h"
+#include "transfer.h"
+#include "script.h"
+#include "serial_speed.h"
 #include "i18n.h"
 
 #include <config.h>
@@ -56,54 +63,557 @@ int serial_port_fd = -1;
 guint callback_handler_in, callback_handler_err;
 gboolean callback_activated = FALSE;
 
+/* Reception by Lis_port() */
+static guint reception_size = BUFFER_RECEPTION;
+static guint rearm_handler = 0;
+static guint64 reception_dispatches = 0;
+static guint64 reception_exhausted = 0;
+static guint64 reception_bytes = 0;
+static gint64 reception_time = 0;
+static gint64 reception_time_max = 0;
+
+/* Framing by idle gaps */
+static frame_detector_t frame_detector = {0, 0, 0};
+static gint64 frame_last_data = 0;  /* in ns */
+static guint frame_timer = 0;
+
+/* Driver latency settings changed by the low latency mode, */
+/* restored when the port is closed                         */
+static gboolean low_latency_set = FALSE;
+static gchar *latency_timer_file = NULL;
+static gint latency_timer_saved = -1;
+
+/* Transmission queue, drained when the port is writable */
+static GByteArray *tx_queue = NULL;
+static guint tx_offset = 0;        /* first byte not written yet */
+static guint tx_watch = 0;
+static guint tx_queued_max = 0;
+static guint64 tx_bytes = 0;
+static guint64 tx_full = 0;        /* writes which found the driver full */
+static guint64 tx_rejected = 0;    /* bytes refused because the queue was full */
+static gint64 tx_window_start = 0;
+static guint64 tx_window_bytes = 0;
+static gdouble tx_rate = 0;
+
+/* RS485 half-duplex: RTS is set by the driver when it supports it, */
+/* else by the state machine below around each transmission         */
+enum
+{
+	RS485_IDLE,                  /* RTS off, receiving */
+	RS485_BEFORE,                /* RTS on, waiting before transmitting */
+	RS485_SENDING,               /* the queue is written */
+	RS485_DRAINING,              /* waiting for the UART to be empty */
+	RS485_AFTER                  /* waiting before setting RTS off */
+};
+static gint rs485_state = RS485_IDLE;
+static guint rs485_timer = 0;
+static gboolean rs485_kernel = FALSE;
+#if defined(HAVE_LINUX_SERIAL_H) && defined(TIOCSRS485)
+static struct serial_rs485 rs485_saved;
+#endif
+
+/* Baud rate accepted by the driver, can differ from config.vitesse */
+static gint actual_speed = 0;
+
+/* Blocking descriptor of the receive thread, -1 if it uses serial_port_fd */
+static int reader_fd = -1;
+
 extern struct configuration_port config;
 
+static gboolean frame_timeout(gpointer data);
+
+static void arm_frame_timer(gint64 delay)
+{
+	/* lower priority than the reception, so that data which has */
+	/* already arrived is processed before the frame is ended    */
+	if(frame_timer == 0)
+		frame_timer = g_timeout_add_full(G_PRIORITY_LOW, MAX(delay / 1000000, 1),
+		                                 frame_timeout, NULL, NULL);
+}
+
+/* Ends the displayed frame once the line has been idle long enough, */
+/* instead of waiting for the next frame                             */
+static gboolean frame_timeout(gpointer data)
+{
+	gint64 idle;
+
+	frame_timer = 0;
+	idle = g_get_monotonic_time() * 1000 - frame_last_data;
+
+	if(idle < frame_detector.gap)
+		arm_frame_timer(frame_detector.gap - idle);
+	else
+		put_frame_break(config.frame_size);
+
+	return FALSE;
+}
+
+static void frame_break(void)
+{
+	put_frame_break(config.frame_size);
+}
+
+static void setup_frame_detector(void)
+{
+	gint bits;
+
+	frame_detector.gap = 0;
+	frame_detector.last_arrival = 0;
+
+	if(config.frame_gap <= 0 || config.vitesse <= 0)
+		return;
+
+	/* start bit, data bits, parity bit and stop bits */
+	bits = 1 + config.bits + (config.parite != 0 ? 1 : 0) + config.stops;
+	frame_detector.char_time = (gint64)bits * 1000000000 / config.vitesse;
+	frame_detector.gap = MAX((gint64)(config.frame_gap * frame_detector.char_time), 1);
+}
+
+/* Returns TRUE if the bytes read at arrival (in us, monotonic) come */
+/* after an idle gap, and so start a new frame                       */
+gboolean frame_detector_update(frame_detector_t *detector, gint64 arrival, guint bytes)
+{
+	gint64 end, start;
+	gboolean new_frame;
+
+	if(detector->gap == 0)
+		return FALSE;
+
+	/* read() returns once the last of the bytes has arrived */
+	end = arrival * 1000;
+	start = end - detector->char_time * bytes;
+	new_frame = start - detector->last_arrival >= detector->gap;
+	detector->last_arrival = end;
+
+	return new_frame;
+}
+
+static void process_received_chars(gchar *c, gint bytes_read)
+{
+	guint i;
+
+	/* a file transfer takes everything */
+	if(transfer_received(c, bytes_read))
+		return;
+
+	put_chars(c, bytes_read, config.crlfauto, config.esc_clear_screen);
+	latency_test_received(c, bytes_read);
+	script_received(c, bytes_read);
+
+	if(frame_detector.gap != 0)
+	{
+		frame_last_data = g_get_monotonic_time() * 1000;
+		arm_frame_timer(frame_detector.gap);
+	}
+
+	if(config.car != -1 && waiting_for_char == TRUE)
+	{
+		i = 0;
+		while(i < bytes_read)
+		{
+			if(c[i] == config.car)
+			{
+				waiting_for_char = FALSE;
+				add_input();
+				i = bytes_read;
+			}
+			i++;
+		}
+	}
+}
+
+gboolean Lis_port(GIOChannel *, GIOCondition, gpointer);
+
+static guint add_reception_watch(void)
+{
+	GIOChannel *channel;
+	guint id;
+
+	channel = g_io_channel_unix_new(serial_port_fd);
+	id = g_io_add_watch_full(channel, 10, G_IO_IN, (GIOFunc)Lis_port, NULL, NULL);
+	g_io_channel_unref(channel);
+
+	return id;
+}
+
+static gboolean rearm_reception(gpointer data)
+{
+	rearm_handler = 0;
+	callback_handler_in = add_reception_watch();
+
+	return FALSE;
+}
+
 gboolean Lis_port(GIOChannel* src, GIOCondition cond, gpointer data)
 {
+	static gchar c[RECEPTION_MAX_SIZE];
 	gint bytes_read;
-	static gchar c[BUFFER_RECEPTION];
-	guint i;
+	guint size, total = 0;
+	gint64 start, elapsed;
 
-	bytes_read = BUFFER_RECEPTION;
+	start = g_get_monotonic_time();
 
-	while(bytes_read == BUFFER_RECEPTION)
+	do
 	{
-		bytes_read = read(serial_port_fd, c, BUFFER_RECEPTION);
+		size = reception_size;
+		bytes_read = read(serial_port_fd, c, size);
 		if(bytes_read > 0)
 		{
-			put_chars(c, bytes_read, config.crlfauto, config.esc_clear_screen);
+			if(frame_detector_update(&frame_detector, g_get_monotonic_time(), bytes_read))
+				frame_break();
+			process_received_chars(c, bytes_read);
+			total += bytes_read;
 
-			if(config.car != -1 && waiting_for_char == TRUE)
-			{
-				i = 0;
-				while(i < bytes_read)
-				{
-					if(c[i] == config.car)
-					{
-						waiting_for_char = FALSE;
-						add_input();
-						i = bytes_read;
-					}
-					i++;
-				}
-			}
+			/* read more at once under load, less when data trickles in */
+			if(bytes_read == size)
+				reception_size = MIN(reception_size * 2, RECEPTION_MAX_SIZE);
+			else if(bytes_read < size / 4)
+				reception_size = MAX(reception_size / 2, RECEPTION_MIN_SIZE);
 		}
 		else if(bytes_read == -1)
 		{
 			if(errno != EAGAIN)
 				perror(config.port);
 		}
+		elapsed = g_get_monotonic_time() - start;
+	}
+	while(bytes_read == size && total < RECEPTION_BUDGET_BYTES && elapsed < RECEPTION_BUDGET_TIME);
+
+	reception_dispatches++;
+	reception_bytes += total;
+	reception_time += elapsed;
+	reception_time_max = MAX(reception_time_max, elapsed);
+
+	/* The budget is exhausted but there is more to read: let the */
+	/* drawing and the other lower priority sources run first     */
+	if(bytes_read == size)
+	{
+		reception_exhausted++;
+		callback_handler_in = 0;
+		rearm_handler = g_idle_add(rearm_reception, NULL);
+		return FALSE;
 	}
 
 	return TRUE;
 }
 
+void serial_append_statistics(GString *string)
+{
+	g_string_append_printf(string,
+	                       _("Transmission:\n"
+	                         "  Bytes sent: %" G_GUINT64_FORMAT " (%.0f bytes/s)\n"
+	                         "  Queued: %u bytes, %u max\n"
+	                         "  Driver full: %" G_GUINT64_FORMAT " times\n"
+	                         "  Refused, queue full: %" G_GUINT64_FORMAT " bytes\n"),
+	                       tx_bytes, serial_tx_rate(),
+	                       serial_tx_queued(), tx_queued_max,
+	                       tx_full, tx_rejected);
+
+	if(serial_port_fd != -1)
+		g_string_append_printf(string,
+		                       _("Port latency:\n"
+		                         "  Low latency mode: %s\n"
+		                         "  USB latency timer: %s\n"
+		                         "  VMIN: %d, VTIME: %d ms\n"),
+		                       low_latency_set ? _("set") : config.low_latency ? _("not supported") : _("off"),
+		                       latency_timer_saved >= 0 ? _("1 ms") : _("unchanged"),
+		                       config.vmin, config.vtime * 100);
+
+	if(rx_thread_running())
+		return;
+
+	g_string_append_printf(string,
+	                       _("Reception:\n"
+	                         "  Read size: %u bytes\n"
+	                         "  Dispatches: %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " stopped by the budget\n"
+	                         "  Dispatch time: %.0f us average, %" G_GINT64_FORMAT " us max\n"
+	                         "  Average: %.0f bytes/dispatch\n"),
+	                       reception_size,
+	                       reception_dispatches, reception_exhausted,
+	                       reception_dispatches ? (gdouble)reception_time / reception_dispatches : 0.0,
+	                       reception_time_max,
+	                       reception_dispatches ? (gdouble)reception_bytes / reception_dispatches : 0.0);
+}
+
 gboolean io_err(GIOChannel* src, GIOCondition cond, gpointer data)
 {
 	Close_port();
 	return TRUE;
 }
 
+static void tx_update_rate(gint64 now)
+{
+	gint64 elapsed = now - tx_window_start;
+
+	if(elapsed < G_USEC_PER_SEC)
+		return;
+
+	tx_rate = (gdouble)tx_window_bytes * G_USEC_PER_SEC / elapsed;
+	tx_window_start = now;
+	tx_window_bytes = 0;
+}
+
+/* Writes what the driver takes without blocking. Returns -1 on error */
+static gint tx_write(const gchar *string, guint length)
+{
+	gint bytes_written;
+
+	bytes_written = write(serial_port_fd, string, length);
+	if(bytes_written == -1)
+	{
+		if(errno != EAGAIN && errno != EINTR)
+			return -1;
+		tx_full++;
+		return 0;
+	}
+	if((guint)bytes_written < length)
+		tx_full++;
+
+	tx_bytes += bytes_written;
+	tx_window_bytes += bytes_written;
+	tx_update_rate(g_get_monotonic_time());
+
+	return bytes_written;
+}
+
+static void rs485_sent(void);
+
+static void tx_start(void)
+{
+	GIOChannel *channel;
+
+	if(tx_watch != 0)
+		return;
+
+	channel = g_io_channel_unix_new(serial_port_fd);
+	tx_watch = g_io_add_watch_full(channel, 10, G_IO_OUT, (GIOFunc)tx_drain, NULL, NULL);
+	g_io_channel_unref(channel);
+}
+
+static void tx_queue_clear(void)
+{
+	if(tx_watch != 0)
+		g_source_remove(tx_watch);
+	tx_watch = 0;
+
+	if(tx_queue != NULL)
+		g_byte_array_set_size(tx_queue, 0);
+	tx_offset = 0;
+}
+
+static gboolean tx_drain(GIOChannel *src, GIOCondition cond, gpointer data)
+{
+	gint bytes_written;
+
+	bytes_written = tx_write((gchar *)tx_queue->data + tx_offset, tx_queue->len - tx_offset);
+	if(bytes_written == -1)
+		perror(config.port);
+	else
+		tx_offset += bytes_written;
+
+	if(bytes_written == -1 || tx_offset == tx_queue->len)
+	{
+		tx_watch = 0;
+		tx_queue_clear();
+		if(rs485_state == RS485_SENDING)
+			rs485_sent();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Queues what fits, returns how many bytes were taken */
+static guint tx_enqueue(const gchar *string, guint length)
+{
+	guint queued;
+
+	if(tx_queue == NULL)
+		tx_queue = g_byte_array_new();
+
+	queued = serial_tx_queued();
+	if(queued + length > TX_QUEUE_MAX)
+	{
+		tx_rejected += queued + length - TX_QUEUE_MAX;
+		length = TX_QUEUE_MAX - queued;
+	}
+	if(length == 0)
+		return 0;
+
+	/* drop what is already written once it is most of the queue */
+	if(tx_offset > tx_queue->len / 2)
+	{
+		g_byte_array_remove_range(tx_queue, 0, tx_offset);
+		tx_offset = 0;
+	}
+
+	g_byte_array_append(tx_queue, (const guint8 *)string, length);
+	tx_queued_max = MAX(tx_queued_max, serial_tx_queued());
+
+	return length;
+}
+
+static void set_rts(gboolean on)
+{
+	int flag = TIOCM_RTS;
+
+	if(ioctl(serial_port_fd, on ? TIOCMBIS : TIOCMBIC, &flag) == -1)
+		i18n_perror(_("RTS write"));
+}
+
+/* Time to send one character, in us */
+static gint64 char_time(void)
+{
+	gint bits;
+
+	if(config.vitesse <= 0)
+		return 0;
+
+	/* start bit, data bits, parity bit and stop bits */
+	bits = 1 + config.bits + (config.parite != 0 ? 1 : 0) + config.stops;
+
+	return (gint64)bits * G_USEC_PER_SEC / config.vitesse;
+}
+
+static gboolean rs485_step(gpointer data);
+
+static void rs485_wait(gint state, gint64 delay)
+{
+	rs485_state = state;
+	rs485_timer = g_timeout_add(MAX((delay + 999) / 1000, 1), rs485_step, NULL);
+}
+
+/* Bytes still in the driver and the UART, 0 once the last one is out */
+static gint rs485_pending(void)
+{
+	int pending = 0;
+#ifdef TIOCSERGETLSR
+	unsigned int lsr;
+
+	if(ioctl(serial_port_fd, TIOCSERGETLSR, &lsr) != -1 && (lsr & TIOCSER_TEMT))
+		return 0;
+#endif
+
+	if(ioctl(serial_port_fd, TIOCOUTQ, &pending) == -1)
+		return 0;
+
+	/* at least the character in the shift register */
+	return MAX(pending, 1);
+}
+
+/* The queue is written: wait for the UART to be empty */
+static void rs485_sent(void)
+{
+	gint pending = rs485_pending();
+
+	if(pending == 0)
+		rs485_wait(RS485_AFTER, config.rs485_rts_time_after_transmit * 1000);
+	else
+		rs485_wait(RS485_DRAINING, pending * char_time());
+}
+
+static gboolean rs485_step(gpointer data)
+{
+	gint pending;
+
+	rs485_timer = 0;
+
+	switch(rs485_state)
+	{
+	case RS485_BEFORE:
+		rs485_state = RS485_SENDING;
+		tx_start();
+		break;
+
+	case RS485_DRAINING:
+		pending = rs485_pending();
+		if(pending > 0)
+			rs485_wait(RS485_DRAINING, pending * char_time());
+		else
+			rs485_wait(RS485_AFTER, config.rs485_rts_time_after_transmit * 1000);
+		break;
+
+	case RS485_AFTER:
+		/* reset RTS (end of send, now receiving back) */
+		set_rts(FALSE);
+		rs485_state = RS485_IDLE;
+		break;
+	}
+
+	return FALSE;
+}
+
+/* Something was queued: RTS up, then transmit */
+static void rs485_start(void)
+{
+	switch(rs485_state)
+	{
+	case RS485_IDLE:
+		set_rts(TRUE);
+		if(config.rs485_rts_time_before_transmit > 0)
+			rs485_wait(RS485_BEFORE, config.rs485_rts_time_before_transmit * 1000);
+		else
+		{
+			rs485_state = RS485_SENDING;
+			tx_start();
+		}
+		break;
+
+	case RS485_DRAINING:
+	case RS485_AFTER:
+		/* RTS is still on */
+		g_source_remove(rs485_timer);
+		rs485_timer = 0;
+		rs485_state = RS485_SENDING;
+		tx_start();
+		break;
+
+	default:
+		/* already on the way */
+		break;
+	}
+}
+
+static void rs485_stop(void)
+{
+	if(rs485_timer != 0)
+		g_source_remove(rs485_timer);
+	rs485_timer = 0;
+	rs485_state = RS485_IDLE;
+
+#if defined(HAVE_LINUX_SERIAL_H) && defined(TIOCSRS485)
+	if(rs485_kernel)
+		ioctl(serial_port_fd, TIOCSRS485, &rs485_saved);
+#endif
+	rs485_kernel = FALSE;
+}
+
+/* Lets the driver set RTS around the transmissions, with the delays */
+static gboolean rs485_kernel_setup(void)
+{
+#if defined(HAVE_LINUX_SERIAL_H) && defined(TIOCSRS485)
+	struct serial_rs485 rs485;
+
+	if(ioctl(serial_port_fd, TIOCGRS485, &rs485_saved) == -1)
+		return FALSE;
+
+	rs485 = rs485_saved;
+	rs485.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+	rs485.flags &= ~SER_RS485_RTS_AFTER_SEND;
+	rs485.delay_rts_before_send = config.rs485_rts_time_before_transmit;
+	rs485.delay_rts_after_send = config.rs485_rts_time_after_transmit;
+
+	if(ioctl(serial_port_fd, TIOCSRS485, &rs485) == -1)
+		return FALSE;
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/* Returns the number of bytes written or queued, which can be less */
+/* than length when the queue is full, or -1 on error               */
 int Send_chars(char *string, int length)
 {
 	int bytes_written = 0;
@@ -115,35 +625,167 @@ int Send_chars(char *string, int length)
 	if(length == 0)
 		return 0;
 
-	/* RS485 half-duplex mode ? */
-	if( config.flux==3 )
+	/* RS485 half-duplex mode without the driver: RTS has to be */
+	/* set before anything is written                           */
+	if(config.flux == 3 && !rs485_kernel)
 	{
-		/* set RTS (start to send) */
-		Set_signals( 1 );
-		if( config.rs485_rts_time_before_transmit>0 )
-			usleep(config.rs485_rts_time_before_transmit*1000);
+		bytes_written = tx_enqueue(string, length);
+		if(bytes_written > 0)
+			rs485_start();
+		return bytes_written;
 	}
 
-	bytes_written = write(serial_port_fd, string, length);
+	/* straight to the driver, unless older data is still waiting */
+	if(serial_tx_queued() == 0)
+	{
+		bytes_written = tx_write(string, length);
+		if(bytes_written == -1)
+			return -1;
+	}
 
-	/* RS485 half-duplex mode ? */
-	if( config.flux==3 )
+	if(bytes_written < length)
 	{
-		/* wait all chars are send */
-		tcdrain( serial_port_fd );
-		if( config.rs485_rts_time_after_transmit>0 )
-			usleep(config.rs485_rts_time_after_transmit*1000);
-		/* reset RTS (end of send, now receiving back) */
-		Set_signals( 1 );
+		bytes_written += tx_enqueue(string + bytes_written, length - bytes_written);
+		tx_start();
 	}
 
 	return bytes_written;
 }
 
+guint serial_tx_queued(void)
+{
+	return tx_queue != NULL ? tx_queue->len - tx_offset : 0;
+}
+
+/* In bytes per second, over the last second */
+gdouble serial_tx_rate(void)
+{
+	gint64 now = g_get_monotonic_time();
+
+	tx_update_rate(now);
+
+	/* nothing written for a while */
+	if(now - tx_window_start >= 2 * G_USEC_PER_SEC)
+		return 0;
+
+	return tx_rate;
+}
+
+/* Drops what is not written yet, when a protocol goes back in the file */
+void serial_tx_discard(void)
+{
+	tx_queue_clear();
+
+	if(serial_port_fd != -1)
+		tcflush(serial_port_fd, TCOFLUSH);
+
+	if(rs485_state == RS485_SENDING)
+		rs485_sent();
+}
+
+/* Where the USB serial drivers (FTDI...) expose the timer after which */
+/* the adapter sends what it has received, 16 ms by default            */
+static gchar *get_latency_timer_file(void)
+{
+	gchar *device, *name, *file;
+
+	device = realpath(config.port, NULL);
+	if(device == NULL)
+		return NULL;
+
+	name = g_path_get_basename(device);
+	file = g_strdup_printf("/sys/class/tty/%s/device/latency_timer", name);
+	free(device);
+	g_free(name);
+
+	return file;
+}
+
+/* Not g_file_set_contents(), which replaces the file */
+static gboolean write_latency_timer(gint timer)
+{
+	FILE *file;
+	gboolean done;
+
+	file = fopen(latency_timer_file, "w");
+	if(file == NULL)
+		return FALSE;
+
+	done = fprintf(file, "%d", timer) > 0;
+	done = fclose(file) == 0 && done;
+
+	return done;
+}
+
+static void set_low_latency(void)
+{
+	gchar *contents = NULL;
+	gint timer;
+#ifdef HAVE_LINUX_SERIAL_H
+	struct serial_struct ser;
+
+	if(ioctl(serial_port_fd, TIOCGSERIAL, &ser) != -1 && !(ser.flags & ASYNC_LOW_LATENCY))
+	{
+		ser.flags |= ASYNC_LOW_LATENCY;
+		low_latency_set = ioctl(serial_port_fd, TIOCSSERIAL, &ser) != -1;
+	}
+#endif
+
+	/* Usually only writable by root: ignored if it cannot be changed */
+	latency_timer_file = get_latency_timer_file();
+	if(latency_timer_file == NULL)
+		return;
+
+	if(g_file_get_contents(latency_timer_file, &contents, NULL, NULL))
+	{
+		timer = atoi(contents);
+		if(timer > 1 && write_latency_timer(1))
+			latency_timer_saved = timer;
+		g_free(contents);
+	}
+}
+
+static void restore_low_latency(void)
+{
+#ifdef HAVE_LINUX_SERIAL_H
+	struct serial_struct ser;
+
+	if(low_latency_set && ioctl(serial_port_fd, TIOCGSERIAL, &ser) != -1)
+	{
+		ser.flags &= ~ASYNC_LOW_LATENCY;
+		ioctl(serial_port_fd, TIOCSSERIAL, &ser);
+	}
+#endif
+	low_latency_set = FALSE;
+
+	if(latency_timer_saved >= 0)
+		write_latency_timer(latency_timer_saved);
+	latency_timer_saved = -1;
+
+	g_free(latency_timer_file);
+	latency_timer_file = NULL;
+}
+
+/* termios2 first, then the deprecated custom divisor, which only */
+/* gives rates dividing the UART clock and which most USB adapters */
+/* ignore                                                          */
+static gboolean set_arbitrary_speed(void)
+{
+	actual_speed = set_termios2_speed(serial_port_fd, config.vitesse);
+
+#ifdef HAVE_LINUX_SERIAL_H
+	if(actual_speed == -1)
+		actual_speed = set_custom_speed(config.vitesse, serial_port_fd);
+#endif
+
+	return actual_speed > 0;
+}
+
 gboolean Config_port(void)
 {
 	struct termios termios_p;
 	gchar *msg = NULL;
+	gboolean arbitrary_speed = FALSE;
 
 	Close_port();
 
@@ -228,18 +870,24 @@ gboolean Config_port(void)
 	case 2000000:
 		termios_p.c_cflag = B2000000;
 		break;
+	case 2500000:
+		termios_p.c_cflag = B2500000;
+		break;
+	case 3000000:
+		termios_p.c_cflag = B3000000;
+		break;
+	case 3500000:
+		termios_p.c_cflag = B3500000;
+		break;
+	case 4000000:
+		termios_p.c_cflag = B4000000;
+		break;
 
 	default:
-#ifdef HAVE_LINUX_SERIAL_H
-		set_custom_speed(config.vitesse, serial_port_fd);
-		termios_p.c_cflag |= B38400;
-#else
-		Close_port();
-		msg = g_strdup_printf(_("Arbitrary baud rates not supported"));
-		show_message(msg, MSG_ERR);
-		g_free(msg);
-		return FALSE;
-#endif
+		/* set once the rest of the termios is applied */
+		termios_p.c_cflag = B38400;
+		arbitrary_speed = TRUE;
+		break;
 	}
 
 	switch(config.bits)
@@ -286,17 +934,60 @@ gboolean Config_port(void)
 	}
 	termios_p.c_oflag = 0;
 	termios_p.c_lflag = 0;
-	termios_p.c_cc[VTIME] = 0;
-	termios_p.c_cc[VMIN] = 1;
+	termios_p.c_cc[VTIME] = config.vtime;
+	termios_p.c_cc[VMIN] = config.vmin;
 	tcsetattr(serial_port_fd, TCSANOW, &termios_p);
+
+	if(!arbitrary_speed)
+		actual_speed = config.vitesse;
+	else if(!set_arbitrary_speed())
+	{
+		Close_port();
+		msg = g_strdup_printf(_("Arbitrary baud rates not supported"));
+		show_message(msg, MSG_ERR);
+		g_free(msg);
+		return FALSE;
+	}
+	else if(ABS(actual_speed - config.vitesse) > config.vitesse / 50)
+	{
+		/* more than what the UARTs usually tolerate */
+		msg = g_strdup_printf(_("The driver uses %d baud instead of %d"), actual_speed, config.vitesse);
+		show_message(msg, MSG_WRN);
+		g_free(msg);
+	}
+
 	tcflush(serial_port_fd, TCOFLUSH);
 	tcflush(serial_port_fd, TCIFLUSH);
 
-	callback_handler_in = g_io_add_watch_full(g_io_channel_unix_new(serial_port_fd),
-	                      10,
-	                      G_IO_IN,
-	                      (GIOFunc)Lis_port,
-	                      NULL, NULL);
+	if(config.low_latency)
+		set_low_latency();
+
+	if(config.flux == 3)
+	{
+		rs485_kernel = rs485_kernel_setup();
+		/* default = receive */
+		if(!rs485_kernel)
+			set_rts(FALSE);
+	}
+
+	timestamp_reset();
+	setup_frame_detector();
+
+	/* The driver only applies VTIME to blocking reads, but the port is */
+	/* not blocking: the receive thread reads through its own fd        */
+	if(config.rx_thread && config.vtime > 0)
+	{
+		reader_fd = open(config.port, O_RDONLY | O_NOCTTY | O_NDELAY);
+		if(reader_fd != -1)
+			fcntl(reader_fd, F_SETFL, 0);
+	}
+
+	if(config.rx_thread && rx_thread_start(reader_fd != -1 ? reader_fd : serial_port_fd,
+	                                       config.rx_ring_size, &frame_detector,
+	                                       process_received_chars, frame_break, Close_port))
+		callback_handler_in = 0;
+	else
+		callback_handler_in = add_reception_watch();
 
 	callback_handler_err = g_io_add_watch_full(g_io_channel_unix_new(serial_port_fd),
 	                       10,
@@ -330,12 +1021,27 @@ void Close_port(void)
 {
 	if(serial_port_fd != -1)
 	{
+		rx_thread_stop();
+		tx_queue_clear();
+		rs485_stop();
+		if(reader_fd != -1)
+			close(reader_fd);
+		reader_fd = -1;
+		restore_low_latency();
 		if(callback_activated == TRUE)
 		{
-			g_source_remove(callback_handler_in);
+			if(callback_handler_in != 0)
+				g_source_remove(callback_handler_in);
+			if(rearm_handler != 0)
+				g_source_remove(rearm_handler);
+			callback_handler_in = 0;
+			rearm_handler = 0;
 			g_source_remove(callback_handler_err);
 			callback_activated = FALSE;
 		}
+		if(frame_timer != 0)
+			g_source_remove(frame_timer);
+		frame_timer = 0;
 		tcsetattr(serial_port_fd, TCSANOW, &termios_save);
 		tcflush(serial_port_fd, TCOFLUSH);
 		tcflush(serial_port_fd, TCIFLUSH);
@@ -388,12 +1094,6 @@ int lis_sig(void)
 	static int stat = 0;
 	int stat_read;
 
-	if ( config.flux==3 )
-	{
-		//reset RTS (default = receive)
-		Set_signals( 1 );
-	}
-
 	if(serial_port_fd != -1)
 	{
 		if(ioctl(serial_port_fd, TIOCMGET, &stat_read) == -1)
@@ -435,7 +1135,8 @@ gint set_custom_speed(int speed, int port_fd)
 	struct serial_struct ser;
 	int arby;
 
-	ioctl(port_fd, TIOCGSERIAL, &ser);
+	if(ioctl(port_fd, TIOCGSERIAL, &ser) == -1 || ser.baud_base == 0)
+		return -1;
 	ser.custom_divisor = ser.baud_base / speed;
 	if(!(ser.custom_divisor))
 		ser.custom_divisor = 1;
@@ -444,15 +1145,17 @@ gint set_custom_speed(int speed, int port_fd)
 	ser.flags &= ~ASYNC_SPD_MASK;
 	ser.flags |= ASYNC_SPD_CUST;
 
-	ioctl(port_fd, TIOCSSERIAL, &ser);
+	if(ioctl(port_fd, TIOCSSERIAL, &ser) == -1)
+		return -1;
 
-	return 0;
+	/* the rate actually used */
+	return arby;
 }
 #endif
 
 gchar* get_port_string(void)
 {
-	gchar* msg;
+	gchar* msg, *string;
 	gchar parity;
 
 	if(serial_port_fd == -1)
@@ -485,6 +1188,13 @@ gchar* get_port_string(void)
 		                      parity,
 		                      config.stops
 		                     );
+
+		if(actual_speed > 0 && actual_speed != config.vitesse)
+		{
+			string = msg;
+			msg = g_strdup_printf(_("%s (actually %d baud)"), string, actual_speed);
+			g_free(string);
+		}
 	}
 
 	return msg;
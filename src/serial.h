@@ -28,10 +28,30 @@ void configure_esc_clear_screen(gboolean);
 void sendbreak(void);
 gint set_custom_speed(int, int);
 gchar* get_port_string(void);
+void serial_append_statistics(GString *);
+guint serial_tx_queued(void);
+gdouble serial_tx_rate(void);
+void serial_tx_discard(void);
+
+/* Detection of the idle gaps between frames, times in ns */
+typedef struct
+{
+	gint64 gap;                  /* 0: no framing */
+	gint64 char_time;
+	gint64 last_arrival;
+} frame_detector_t;
+
+gboolean frame_detector_update(frame_detector_t *, gint64, guint);
 
 #define BUFFER_RECEPTION 8192
+#define RECEPTION_MIN_SIZE 1024
+#define RECEPTION_MAX_SIZE (64 * 1024)
+#define RECEPTION_BUDGET_BYTES (256 * 1024) /* per dispatch */
+#define RECEPTION_BUDGET_TIME 10000          /* per dispatch, in us */
 #define BUFFER_EMISSION 4096
+#define TX_QUEUE_MAX (1024 * 1024)
 #define LINE_FEED 0x0A
+#define CARRIAGE_RETURN 0x0D
 #define POLL_DELAY 100               /* in ms (for control signals) */
 
 #endif
@@ -0,0 +1,58 @@
+/***********************************************************************/
+/* serial_speed.c                                                      */
+/* --------------                                                      */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Arbitrary baud rates with termios2                             */
+/*                                                                     */
+/*      struct termios2 comes from the kernel headers, which cannot    */
+/*      be used together with the termios.h of the C library: it is    */
+/*      kept apart from serial.c in this file.                         */
+/*                                                                     */
+/***********************************************************************/
+
+#include <config.h>
+#include <errno.h>
+
+#ifdef HAVE_TERMIOS2
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#endif
+
+#include "serial_speed.h"
+
+/* Sets the baud rate of the port with BOTHER, the other settings are */
+/* kept. Returns the rate used by the driver, -1 if it is not supported */
+int set_termios2_speed(int port_fd, int speed)
+{
+#ifdef HAVE_TERMIOS2
+	struct termios2 tio;
+
+	if(ioctl(port_fd, TCGETS2, &tio) == -1)
+		return -1;
+
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_ospeed = speed;
+
+	/* B0 as input speed: the same as the output speed */
+	tio.c_cflag &= ~(CBAUD << IBSHIFT);
+	tio.c_ispeed = speed;
+
+	if(ioctl(port_fd, TCSETS2, &tio) == -1)
+		return -1;
+
+	/* read back what the driver could do */
+	if(ioctl(port_fd, TCGETS2, &tio) == -1)
+		return -1;
+
+	return tio.c_ospeed;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
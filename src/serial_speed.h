@@ -0,0 +1,20 @@
+/***********************************************************************/
+/* serial_speed.h                                                      */
+/* --------------                                                      */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Arbitrary baud rates with termios2                             */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef SERIAL_SPEED_H_
+#define SERIAL_SPEED_H_
+
+int set_termios2_speed(int, int);
+
+#endif
@@ -0,0 +1,54 @@
+/***********************************************************************/
+/* special_char.c                                                      */
+/* --------------                                                      */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Search of the received characters put_chars() transforms       */
+/*                                                                     */
+/*      Only glib is needed, so that the benchmark can be built        */
+/*      without the user interface.                                    */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <string.h>
+
+#include "special_char.h"
+
+#define SWAR_ONES G_GUINT64_CONSTANT(0x0101010101010101)
+#define SWAR_HIGHS G_GUINT64_CONSTANT(0x8080808080808080)
+/* non zero if one of the 8 bytes of word is equal to byte */
+#define SWAR_HAS_BYTE(word, byte) \
+	((((word) ^ (SWAR_ONES * (byte))) - SWAR_ONES) & ~((word) ^ (SWAR_ONES * (byte))) & SWAR_HIGHS)
+
+/* Returns the length of the run of characters that need no transformation */
+unsigned int find_special_char(const char *chars, unsigned int size, gboolean crlf_auto, gboolean esc_clear_screen)
+{
+	unsigned int i = 0;
+	guint64 word, found;
+
+	/* look at 8 bytes at a time, then locate the exact byte below */
+	for(; i + sizeof(word) <= size; i += sizeof(word))
+	{
+		memcpy(&word, &chars[i], sizeof(word));
+		found = SWAR_HAS_BYTE(word, '\n');
+		if(crlf_auto)
+			found |= SWAR_HAS_BYTE(word, '\r');
+		if(esc_clear_screen)
+			found |= SWAR_HAS_BYTE(word, 0x1b);
+		if(found)
+			break;
+	}
+
+	for(; i < size; i++)
+	{
+		if(is_special_char(chars[i], crlf_auto, esc_clear_screen))
+			break;
+	}
+
+	return i;
+}
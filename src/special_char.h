@@ -0,0 +1,26 @@
+/***********************************************************************/
+/* special_char.h                                                      */
+/* --------------                                                      */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Search of the received characters put_chars() transforms       */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef SPECIAL_CHAR_H_
+#define SPECIAL_CHAR_H_
+
+/* LF, CR in auto CR/LF mode and ESC when it clears the screen */
+static inline gboolean is_special_char(char c, gboolean crlf_auto, gboolean esc_clear_screen)
+{
+	return c == '\n' || (crlf_auto && c == '\r') || (esc_clear_screen && c == '\x1b');
+}
+
+unsigned int find_special_char(const char *, unsigned int, gboolean, gboolean);
+
+#endif
@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 #include <vte/vte.h>
 #include <glib/gi18n.h>
 
@@ -47,12 +48,18 @@
 #include "interface.h"
 #include "parsecfg.h"
 #include "macros.h"
+#include "render.h"
+#include "buffer.h"
+#include "timestamp.h"
+#include "logging.h"
+#include "rx_thread.h"
 #include "i18n.h"
 #include "config.h"
 
 
 #define DEVICE_NUMBERS_TO_CHECK 12
 #define CONFIGURATION_FILENAME ".gtktermrc"
+#define THREAD_WIDGETS 6         /* settings of the receive thread in the dialog */
 
 gchar *devices_to_check[] =
 {
@@ -74,12 +81,27 @@ gchar **parity;
 gchar **flow;
 gint *wait_delay;
 gint *wait_char;
+gint *char_delay;
+gint *send_rate;
 gint *rts_time_before_tx;
 gint *rts_time_after_tx;
 gint *echo;
 gint *crlfauto;
 gint *esc_clear_screen;
 gint *timestamp;
+gint *rx_thread;
+gint *rx_ring_size;
+gint *render_fps;
+gint *buffer_size;
+gchar **buffer_file;
+gchar **timestamp_format_names;
+gdouble *frame_gap;
+gint *frame_size;
+gint *low_latency;
+gint *vmin;
+gint *vtime;
+gint *log_buffer_size;
+gint *log_flush_time;
 cfgList **macro_list = NULL;
 gchar **font;
 
@@ -108,12 +130,27 @@ cfgStruct cfg[] =
 	{"flow", CFG_STRING, &flow},
 	{"wait_delay", CFG_INT, &wait_delay},
 	{"wait_char", CFG_INT, &wait_char},
+	{"char_delay", CFG_INT, &char_delay},
+	{"send_rate", CFG_INT, &send_rate},
 	{"rs485_rts_time_before_tx", CFG_INT, &rts_time_before_tx},
 	{"rs485_rts_time_after_tx", CFG_INT, &rts_time_after_tx},
 	{"echo", CFG_BOOL, &echo},
 	{"crlfauto", CFG_BOOL, &crlfauto},
 	{"esc_clear_screen", CFG_BOOL, &esc_clear_screen},
 	{"timestamp", CFG_BOOL, &timestamp},
+	{"rx_thread", CFG_BOOL, &rx_thread},
+	{"rx_ring_size", CFG_INT, &rx_ring_size},
+	{"render_fps", CFG_INT, &render_fps},
+	{"buffer_size", CFG_INT, &buffer_size},
+	{"buffer_file", CFG_STRING, &buffer_file},
+	{"timestamp_format", CFG_STRING, &timestamp_format_names},
+	{"frame_gap", CFG_DOUBLE, &frame_gap},
+	{"frame_size", CFG_BOOL, &frame_size},
+	{"low_latency", CFG_BOOL, &low_latency},
+	{"vmin", CFG_INT, &vmin},
+	{"vtime", CFG_INT, &vtime},
+	{"log_buffer_size", CFG_INT, &log_buffer_size},
+	{"log_flush_time", CFG_INT, &log_flush_time},
 	{"font", CFG_STRING, &font},
 	{"macros", CFG_STRING_LIST, &macro_list},
 	{"term_block_cursor", CFG_BOOL, &block_cursor},
@@ -140,6 +177,7 @@ display_config_t term_conf;
 GtkWidget *Entry;
 
 gint Grise_Degrise(GtkWidget *bouton, gpointer pointeur);
+gint Grise_Degrise_thread(GtkWidget *bouton, gpointer pointeur);
 void read_font_button(GtkFontButton *fontButton);
 void Hard_default_configuration(void);
 void Copy_configuration(int);
@@ -177,19 +215,31 @@ void config_file_init(void)
 
 void ConfigFlags(void)
 {
+	gchar *message;
+
 	Set_crlfauto(config.crlfauto);
 	Set_esc_clear_screen(config.esc_clear_screen);
 	Set_timestamp(config.timestamp);
+
+	if(!set_buffer_storage(config.buffer_size, config.buffer_file))
+	{
+		message = g_strdup_printf(_("Cannot use %s for the history: %s\n"), config.buffer_file, strerror(errno));
+		show_message(message, MSG_ERR);
+		g_free(message);
+		config.buffer_file[0] = 0;
+		set_buffer_storage(config.buffer_size, NULL);
+	}
 }
 
 void Config_Port_Fenetre(GtkAction *action, gpointer data)
 {
 	GtkWidget *Table, *Label, *Bouton_OK, *Bouton_annule,
 	          *Combo, *Dialogue, *Frame, *CheckBouton,
-	          *Spin, *Expander, *ExpanderVbox,
+	          *Spin, *Expander, *ExpanderVbox, *File_entry,
 	          *content_area, *action_area;
 
-	static GtkWidget *Combos[10];
+	static GtkWidget *Combos[21];
+	static GtkWidget *Thread_widgets[THREAD_WIDGETS];
 	GList *liste = NULL;
 	gchar *chaine = NULL;
 	gchar **dev = NULL;
@@ -291,6 +341,8 @@ void Config_Port_Fenetre(GtkAction *action, gpointer data)
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "1000000");
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "1500000");
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "2000000");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "3000000");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(Combo), "4000000");
 
 	/* set the current choice to the previous setting */
 	switch(config.vitesse)
@@ -340,9 +392,18 @@ void Config_Port_Fenetre(GtkAction *action, gpointer data)
 	case 1000000:
 		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 14);
 		break;
-	case 2000000:
+	case 1500000:
 		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 15);
 		break;
+	case 2000000:
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 16);
+		break;
+	case 3000000:
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 17);
+		break;
+	case 4000000:
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 18);
+		break;
 	case 0:
 		/* no previous setting, use a default */
 		gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), 5);
@@ -444,7 +505,7 @@ void Config_Port_Fenetre(GtkAction *action, gpointer data)
 	Frame = gtk_frame_new(_("ASCII file transfer"));
 	gtk_container_add(GTK_CONTAINER(ExpanderVbox), Frame);
 
-	Table = gtk_table_new(2, 2, FALSE);
+	Table = gtk_table_new(4, 2, FALSE);
 	gtk_container_add(GTK_CONTAINER(Frame), Table);
 
 	Label = gtk_label_new(_("End of line delay (milliseconds):"));
@@ -475,6 +536,26 @@ void Config_Port_Fenetre(GtkAction *action, gpointer data)
 	gtk_table_attach_defaults(GTK_TABLE(Table), CheckBouton, 0, 1, 1, 2);
 	Combos[7] = CheckBouton;
 
+	Label = gtk_label_new(_("Delay after each character (microseconds):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 2, 3);
+
+	adj = gtk_adjustment_new(0.0, 0.0, 1000000.0, 10.0, 100.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.char_delay);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 2, 3, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[19] = Spin;
+
+	Label = gtk_label_new(_("Rate limit (bytes per second, 0 for none):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 3, 4);
+
+	adj = gtk_adjustment_new(0.0, 0.0, 1000000.0, 100.0, 1000.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.send_rate);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 3, 4, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[20] = Spin;
+
 
 	Frame = gtk_frame_new(_("RS-485 half-duplex parameters (RTS signal used to send)"));
 
@@ -502,6 +583,106 @@ void Config_Port_Fenetre(GtkAction *action, gpointer data)
 	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 1, 2, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
 	Combos[9] = Spin;
 
+	Frame = gtk_frame_new(_("Reception"));
+	gtk_container_add(GTK_CONTAINER(ExpanderVbox), Frame);
+
+	Table = gtk_table_new(4, 2, FALSE);
+	gtk_container_add(GTK_CONTAINER(Frame), Table);
+
+	CheckBouton = gtk_check_button_new_with_label(_("Read the port in a dedicated thread"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(CheckBouton), config.rx_thread);
+	gtk_table_attach_defaults(GTK_TABLE(Table), CheckBouton, 0, 2, 0, 1);
+	Combos[10] = CheckBouton;
+
+	Label = gtk_label_new(_("Receive ring size (KiB):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 1, 2);
+	Thread_widgets[0] = Label;
+
+	adj = gtk_adjustment_new(0.0, 16.0, 524288.0, 64.0, 1024.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.rx_ring_size);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 1, 2, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[11] = Spin;
+	Thread_widgets[1] = Spin;
+
+	Label = gtk_label_new(_("History buffer size (KiB):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 2, 3);
+
+	adj = gtk_adjustment_new(0.0, 64.0, 67108864.0, 64.0, 1024.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.buffer_size);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 2, 3, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[12] = Spin;
+
+	Label = gtk_label_new(_("History file (empty to keep it in memory):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 3, 4);
+
+	File_entry = gtk_entry_new();
+	gtk_entry_set_text(GTK_ENTRY(File_entry), config.buffer_file);
+	gtk_table_attach(GTK_TABLE(Table), File_entry, 1, 2, 3, 4, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[13] = File_entry;
+
+	Frame = gtk_frame_new(_("Framing"));
+	gtk_container_add(GTK_CONTAINER(ExpanderVbox), Frame);
+
+	Table = gtk_table_new(2, 2, FALSE);
+	gtk_container_add(GTK_CONTAINER(Frame), Table);
+
+	Label = gtk_label_new(_("New line after an idle time of (characters, 0 for none):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 0, 1);
+
+	adj = gtk_adjustment_new(0.0, 0.0, 1000.0, 0.5, 10.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 1);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), config.frame_gap);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 0, 1, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[14] = Spin;
+
+	CheckBouton = gtk_check_button_new_with_label(_("Show the size of the frames"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(CheckBouton), config.frame_size);
+	gtk_table_attach_defaults(GTK_TABLE(Table), CheckBouton, 0, 2, 1, 2);
+	Combos[15] = CheckBouton;
+
+	Frame = gtk_frame_new(_("Latency"));
+	gtk_container_add(GTK_CONTAINER(ExpanderVbox), Frame);
+
+	Table = gtk_table_new(3, 2, FALSE);
+	gtk_container_add(GTK_CONTAINER(Frame), Table);
+
+	CheckBouton = gtk_check_button_new_with_label(_("Low latency mode of the driver"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(CheckBouton), config.low_latency);
+	gtk_table_attach_defaults(GTK_TABLE(Table), CheckBouton, 0, 2, 0, 1);
+	Combos[16] = CheckBouton;
+
+	Label = gtk_label_new(_("VMIN (bytes, with the dedicated thread):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 1, 2);
+	Thread_widgets[2] = Label;
+
+	adj = gtk_adjustment_new(0.0, 1.0, 255.0, 1.0, 10.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.vmin);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 1, 2, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[17] = Spin;
+	Thread_widgets[3] = Spin;
+
+	Label = gtk_label_new(_("VTIME (1/10 s, with the dedicated thread):"));
+	gtk_table_attach_defaults(GTK_TABLE(Table), Label, 0, 1, 2, 3);
+	Thread_widgets[4] = Label;
+
+	adj = gtk_adjustment_new(0.0, 0.0, 255.0, 1.0, 10.0, 0.0);
+	Spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+	gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(Spin), TRUE);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(Spin), (gfloat)config.vtime);
+	gtk_table_attach(GTK_TABLE(Table), Spin, 1, 2, 2, 3, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 5, 5);
+	Combos[18] = Spin;
+	Thread_widgets[5] = Spin;
+
+	/* the ring, VMIN and VTIME are only used by the receive thread */
+	g_signal_connect(GTK_WIDGET(Combos[10]), "toggled", G_CALLBACK(Grise_Degrise_thread), (gpointer)Thread_widgets);
+	Grise_Degrise_thread(Combos[10], (gpointer)Thread_widgets);
 
 	Bouton_OK = gtk_button_new_with_label(_("OK"));
 	gtk_box_pack_start(GTK_BOX(action_area), Bouton_OK, FALSE, TRUE, 0);
@@ -533,6 +714,17 @@ gint Lis_Config(GtkWidget *bouton, GtkWidget **Combos)
 	config.delai = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[6]));
 	config.rs485_rts_time_before_transmit = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[8]));
 	config.rs485_rts_time_after_transmit = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[9]));
+	config.rx_thread = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(Combos[10]));
+	config.rx_ring_size = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[11]));
+	config.buffer_size = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[12]));
+	g_strlcpy(config.buffer_file, gtk_entry_get_text(GTK_ENTRY(Combos[13])), sizeof(config.buffer_file));
+	config.frame_gap = gtk_spin_button_get_value(GTK_SPIN_BUTTON(Combos[14]));
+	config.frame_size = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(Combos[15]));
+	config.low_latency = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(Combos[16]));
+	config.vmin = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[17]));
+	config.vtime = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[18]));
+	config.char_delay = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[19]));
+	config.send_rate = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(Combos[20]));
 
 
 	message = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(Combos[2]));
@@ -593,6 +785,18 @@ gint Grise_Degrise(GtkWidget *bouton, gpointer pointeur)
 	return FALSE;
 }
 
+gint Grise_Degrise_thread(GtkWidget *bouton, gpointer pointeur)
+{
+	GtkWidget **widgets = (GtkWidget **)pointeur;
+	gboolean active = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(bouton));
+	gint i;
+
+	for(i = 0; i < THREAD_WIDGETS; i++)
+		gtk_widget_set_sensitive(widgets[i], active);
+
+	return FALSE;
+}
+
 void clear_scrollback(void){
     vte_terminal_set_scrollback_lines (VTE_TERMINAL(display), 0);
     vte_terminal_set_scrollback_lines (VTE_TERMINAL(display), term_conf.scrollback);
@@ -963,6 +1167,9 @@ gint Load_configuration_from_file(gchar *config_name)
 				else
 					config.car = -1;
 
+				config.char_delay = char_delay[i];
+				config.send_rate = send_rate[i];
+
 				config.rs485_rts_time_before_transmit = rts_time_before_tx[i];
 				config.rs485_rts_time_after_transmit = rts_time_after_tx[i];
 
@@ -986,6 +1193,65 @@ gint Load_configuration_from_file(gchar *config_name)
 				else
 					config.timestamp = FALSE;
 
+				if(rx_thread[i] != -1)
+					config.rx_thread = (gboolean)rx_thread[i];
+				else
+					config.rx_thread = FALSE;
+
+				if(rx_ring_size[i] != 0)
+					config.rx_ring_size = rx_ring_size[i];
+				else
+					config.rx_ring_size = DEFAULT_RX_RING_SIZE;
+
+				if(render_fps[i] != 0)
+					config.render_fps = render_fps[i];
+				else
+					config.render_fps = DEFAULT_RENDER_FPS;
+
+				if(buffer_size[i] != 0)
+					config.buffer_size = buffer_size[i];
+				else
+					config.buffer_size = DEFAULT_BUFFER_SIZE;
+
+				if(buffer_file[i] != NULL)
+					g_strlcpy(config.buffer_file, buffer_file[i], sizeof(config.buffer_file));
+				else
+					config.buffer_file[0] = 0;
+
+				if(timestamp_format_names[i] != NULL)
+					config.timestamp_format = timestamp_format_from_name(timestamp_format_names[i]);
+				else
+					config.timestamp_format = DEFAULT_TIMESTAMP_FORMAT;
+
+				config.frame_gap = frame_gap[i];
+
+				if(frame_size[i] != -1)
+					config.frame_size = (gboolean)frame_size[i];
+				else
+					config.frame_size = FALSE;
+
+				if(low_latency[i] != -1)
+					config.low_latency = (gboolean)low_latency[i];
+				else
+					config.low_latency = FALSE;
+
+				if(vmin[i] != 0)
+					config.vmin = vmin[i];
+				else
+					config.vmin = DEFAULT_VMIN;
+
+				config.vtime = vtime[i];
+
+				if(log_buffer_size[i] != 0)
+					config.log_buffer_size = log_buffer_size[i];
+				else
+					config.log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
+
+				if(log_flush_time[i] != 0)
+					config.log_flush_time = log_flush_time[i];
+				else
+					config.log_flush_time = DEFAULT_LOG_FLUSH_TIME;
+
 				g_free(term_conf.font);
 				term_conf.font = g_strdup(font[i]);
 
@@ -1125,7 +1391,12 @@ void Verify_configuration(void)
 	case 576000:
 	case 921600:
 	case 1000000:
+	case 1500000:
 	case 2000000:
+	case 2500000:
+	case 3000000:
+	case 3500000:
+	case 4000000:
 		break;
 
 	default:
@@ -1158,6 +1429,82 @@ void Verify_configuration(void)
 		g_free(string);
 	}
 
+	if(config.char_delay < 0 || config.char_delay > 1000000)
+	{
+		string = g_strdup_printf(_("Invalid character delay: %d us\nFalling back to default character delay: %d us\n"), config.char_delay, 0);
+		show_message(string, MSG_ERR);
+		config.char_delay = 0;
+		g_free(string);
+	}
+
+	if(config.send_rate < 0)
+	{
+		string = g_strdup_printf(_("Invalid rate limit: %d bytes/s\nFalling back to no rate limit\n"), config.send_rate);
+		show_message(string, MSG_ERR);
+		config.send_rate = 0;
+		g_free(string);
+	}
+
+	if(config.rx_ring_size < RX_RING_MIN_SIZE || config.rx_ring_size > RX_RING_MAX_SIZE)
+	{
+		string = g_strdup_printf(_("Invalid receive ring size: %d KiB\nFalling back to default receive ring size: %d KiB\n"), config.rx_ring_size, DEFAULT_RX_RING_SIZE);
+		show_message(string, MSG_ERR);
+		config.rx_ring_size = DEFAULT_RX_RING_SIZE;
+		g_free(string);
+	}
+
+	if(config.buffer_size < BUFFER_MIN_SIZE ||
+	   config.buffer_size > (config.buffer_file[0] != 0 ? BUFFER_MAX_FILE_SIZE : BUFFER_MAX_SIZE))
+	{
+		string = g_strdup_printf(_("Invalid history buffer size: %d KiB\nFalling back to default history buffer size: %d KiB\n"), config.buffer_size, DEFAULT_BUFFER_SIZE);
+		show_message(string, MSG_ERR);
+		config.buffer_size = DEFAULT_BUFFER_SIZE;
+		g_free(string);
+	}
+
+	if(config.timestamp_format < 0 || config.timestamp_format >= TIMESTAMP_FORMATS_NUMBER)
+	{
+		string = g_strdup_printf(_("Invalid timestamp format\nFalling back to default timestamp format: %s\n"), timestamp_format_name(DEFAULT_TIMESTAMP_FORMAT));
+		show_message(string, MSG_ERR);
+		config.timestamp_format = DEFAULT_TIMESTAMP_FORMAT;
+		g_free(string);
+	}
+
+	if(config.frame_gap < 0)
+		config.frame_gap = 0;
+
+	if(config.vmin < 1 || config.vmin > 255)
+	{
+		string = g_strdup_printf(_("Invalid VMIN: %d\nFalling back to default VMIN: %d\n"), config.vmin, DEFAULT_VMIN);
+		show_message(string, MSG_ERR);
+		config.vmin = DEFAULT_VMIN;
+		g_free(string);
+	}
+
+	if(config.vtime < 0 || config.vtime > 255)
+	{
+		string = g_strdup_printf(_("Invalid VTIME: %d\nFalling back to default VTIME: %d\n"), config.vtime, DEFAULT_VTIME);
+		show_message(string, MSG_ERR);
+		config.vtime = DEFAULT_VTIME;
+		g_free(string);
+	}
+
+	if(config.log_buffer_size < 1 || config.log_buffer_size > 65536)
+	{
+		string = g_strdup_printf(_("Invalid log buffer size: %d KiB\nFalling back to default log buffer size: %d KiB\n"), config.log_buffer_size, DEFAULT_LOG_BUFFER_SIZE);
+		show_message(string, MSG_ERR);
+		config.log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
+		g_free(string);
+	}
+
+	if(config.log_flush_time < 1 || config.log_flush_time > 60000)
+	{
+		string = g_strdup_printf(_("Invalid log flush time: %d ms\nFalling back to default log flush time: %d ms\n"), config.log_flush_time, DEFAULT_LOG_FLUSH_TIME);
+		show_message(string, MSG_ERR);
+		config.log_flush_time = DEFAULT_LOG_FLUSH_TIME;
+		g_free(string);
+	}
+
 	if(term_conf.font == NULL)
 		term_conf.font = g_strdup_printf(DEFAULT_FONT);
 
@@ -1205,11 +1552,26 @@ void Hard_default_configuration(void)
 	config.rs485_rts_time_before_transmit = DEFAULT_DELAY_RS485;
 	config.rs485_rts_time_after_transmit = DEFAULT_DELAY_RS485;
 	config.car = DEFAULT_CHAR;
+	config.char_delay = 0;
+	config.send_rate = 0;
 	config.echo = DEFAULT_ECHO;
 	config.crlfauto = FALSE;
 	config.esc_clear_screen = FALSE;
 	config.timestamp = FALSE;
   config.disable_port_lock = FALSE;
+	config.rx_thread = FALSE;
+	config.rx_ring_size = DEFAULT_RX_RING_SIZE;
+	config.render_fps = DEFAULT_RENDER_FPS;
+	config.buffer_size = DEFAULT_BUFFER_SIZE;
+	config.buffer_file[0] = 0;
+	config.timestamp_format = DEFAULT_TIMESTAMP_FORMAT;
+	config.frame_gap = 0;
+	config.frame_size = FALSE;
+	config.low_latency = FALSE;
+	config.vmin = DEFAULT_VMIN;
+	config.vtime = DEFAULT_VTIME;
+	config.log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
+	config.log_flush_time = DEFAULT_LOG_FLUSH_TIME;
 
 	term_conf.font = g_strdup_printf(DEFAULT_FONT);
 
@@ -1291,6 +1653,14 @@ void Copy_configuration(int pos)
 	cfgStoreValue(cfg, "wait_char", string, CFG_INI, pos);
 	g_free(string);
 
+	string = g_strdup_printf("%d", config.char_delay);
+	cfgStoreValue(cfg, "char_delay", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.send_rate);
+	cfgStoreValue(cfg, "send_rate", string, CFG_INI, pos);
+	g_free(string);
+
 	string = g_strdup_printf("%d", config.rs485_rts_time_before_transmit);
 	cfgStoreValue(cfg, "rs485_rts_time_before_tx", string, CFG_INI, pos);
 	g_free(string);
@@ -1330,6 +1700,70 @@ void Copy_configuration(int pos)
 	cfgStoreValue(cfg, "timestamp", string, CFG_INI, pos);
 	g_free(string);
 
+	if(config.rx_thread == FALSE)
+		string = g_strdup_printf("False");
+	else
+		string = g_strdup_printf("True");
+
+	cfgStoreValue(cfg, "rx_thread", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.rx_ring_size);
+	cfgStoreValue(cfg, "rx_ring_size", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.render_fps);
+	cfgStoreValue(cfg, "render_fps", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.buffer_size);
+	cfgStoreValue(cfg, "buffer_size", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup(config.buffer_file);
+	cfgStoreValue(cfg, "buffer_file", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup(timestamp_format_name(config.timestamp_format));
+	cfgStoreValue(cfg, "timestamp_format", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%g", config.frame_gap);
+	cfgStoreValue(cfg, "frame_gap", string, CFG_INI, pos);
+	g_free(string);
+
+	if(config.frame_size == FALSE)
+		string = g_strdup_printf("False");
+	else
+		string = g_strdup_printf("True");
+
+	cfgStoreValue(cfg, "frame_size", string, CFG_INI, pos);
+	g_free(string);
+
+	if(config.low_latency == FALSE)
+		string = g_strdup_printf("False");
+	else
+		string = g_strdup_printf("True");
+
+	cfgStoreValue(cfg, "low_latency", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.vmin);
+	cfgStoreValue(cfg, "vmin", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.vtime);
+	cfgStoreValue(cfg, "vtime", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.log_buffer_size);
+	cfgStoreValue(cfg, "log_buffer_size", string, CFG_INI, pos);
+	g_free(string);
+
+	string = g_strdup_printf("%d", config.log_flush_time);
+	cfgStoreValue(cfg, "log_flush_time", string, CFG_INI, pos);
+	g_free(string);
+
 	string = g_strdup(term_conf.font);
 	cfgStoreValue(cfg, "font", string, CFG_INI, pos);
 	g_free(string);
@@ -42,6 +42,8 @@ struct configuration_port
 	gint parite;                 // 0 : None, 1 : Odd, 2 : Even
 	gint flux;                   // 0 : None, 1 : Xon/Xoff, 2 : RTS/CTS, 3 : RS485halfduplex
 	gint delai;                  // end of char delay: in ms
+	gint char_delay;             // delay after each char of a sent file: in us
+	gint send_rate;              // sent files rate limit: in bytes/s, 0: none
 	gint rs485_rts_time_before_transmit;
 	gint rs485_rts_time_after_transmit;
 	gchar car;                   // caractere attendre
@@ -50,6 +52,19 @@ struct configuration_port
 	gboolean esc_clear_screen;   // clear screen when receive ESC char ('\x1b' - 27)
 	gboolean timestamp;
 	gboolean disable_port_lock;
+	gboolean rx_thread;          // read the port in a dedicated thread
+	gint rx_ring_size;           // receive thread ring size, in KiB
+	gint render_fps;             // max terminal updates per second, -1: every frame
+	gint buffer_size;            // history buffer size, in KiB
+	gchar buffer_file[1024];     // history spill file, empty: in memory
+	gint timestamp_format;       // TIMESTAMP_EPOCH, _LOCAL, _ISO8601, _RELATIVE, _DELTA
+	gdouble frame_gap;           // idle time ending a frame, in characters, 0: no framing
+	gboolean frame_size;         // show the size at the end of the frames
+	gboolean low_latency;        // ASYNC_LOW_LATENCY and USB latency timer at 1 ms
+	gint vmin;                   // termios VMIN: 1 - 255
+	gint vtime;                  // termios VTIME: in 1/10 s
+	gint log_buffer_size;        // log file buffers, in KiB
+	gint log_flush_time;         // max time before logged data is written, in ms
 };
 
 typedef struct
@@ -78,5 +93,8 @@ typedef struct
 #define DEFAULT_CHAR -1
 #define DEFAULT_DELAY_RS485 30
 #define DEFAULT_ECHO FALSE
+#define DEFAULT_VMIN 1
+#define DEFAULT_VTIME 0
+#define DEFAULT_RX_RING_SIZE 1024   /* in KiB */
 
 #endif
@@ -0,0 +1,178 @@
+/***********************************************************************/
+/* timestamp.c                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Formatting of the timestamps put in front of received lines    */
+/*                                                                     */
+/*      The clock is read once per received chunk, and the part of    */
+/*      the timestamp up to the seconds is only formatted again when   */
+/*      the seconds change: a line only costs the milliseconds.        */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "term_config.h"
+#include "timestamp.h"
+
+static const gchar *format_names[TIMESTAMP_FORMATS_NUMBER] =
+{
+	"epoch",
+	"local",
+	"iso8601",
+	"relative",
+	"delta"
+};
+
+/* The part of the last timestamp before and after the milliseconds */
+static struct
+{
+	gboolean valid;
+	gint format;
+	gint64 second;
+	gchar prefix[TIMESTAMP_SIZE];
+	guint prefix_length;
+	gchar suffix[16];
+	guint suffix_length;
+} cache;
+
+static gint64 sample;               /* in us, real or monotonic time */
+static gint64 session_start = 0;
+static gint64 previous_line = -1;
+
+extern struct configuration_port config;
+
+static gboolean is_absolute(gint format)
+{
+	return format == TIMESTAMP_EPOCH || format == TIMESTAMP_LOCAL || format == TIMESTAMP_ISO8601;
+}
+
+static void format_prefix(gint format, gint64 second)
+{
+	time_t t = (time_t)second;
+	struct tm tm;
+	gchar zone[8];
+	int size = 0;
+
+	cache.suffix_length = 2;
+	memcpy(cache.suffix, "] ", 2);
+
+	switch(format)
+	{
+	case TIMESTAMP_LOCAL:
+		localtime_r(&t, &tm);
+		size = strftime(cache.prefix, sizeof(cache.prefix), "[%H:%M:%S.", &tm);
+		break;
+
+	case TIMESTAMP_ISO8601:
+		localtime_r(&t, &tm);
+		size = strftime(cache.prefix, sizeof(cache.prefix), "[%Y-%m-%dT%H:%M:%S.", &tm);
+		/* +hhmm from strftime, +hh:mm for the extended format */
+		if(strftime(zone, sizeof(zone), "%z", &tm) == 5)
+			cache.suffix_length = g_snprintf(cache.suffix, sizeof(cache.suffix),
+			                                 "%.3s:%.2s] ", zone, zone + 3);
+		break;
+
+	case TIMESTAMP_RELATIVE:
+	case TIMESTAMP_DELTA:
+		size = g_snprintf(cache.prefix, sizeof(cache.prefix), "[+%" G_GINT64_FORMAT ".", second);
+		break;
+
+	default:
+		size = g_snprintf(cache.prefix, sizeof(cache.prefix), "[%d.%02dh.%02dm.%02ds.",
+		                  (int)(second / (3600 * 24)), (int)(second / 3600 % 24),
+		                  (int)(second / 60 % 60), (int)(second % 60));
+		break;
+	}
+
+	cache.prefix_length = CLAMP(size, 0, (int)sizeof(cache.prefix) - 1);
+	cache.format = format;
+	cache.second = second;
+	cache.valid = TRUE;
+}
+
+/* The relative and delta timestamps start from here */
+void timestamp_reset(void)
+{
+	session_start = g_get_monotonic_time();
+	previous_line = -1;
+}
+
+/* Called once per received chunk: all its lines get the same time */
+void timestamp_sample(void)
+{
+	if(is_absolute(config.timestamp_format))
+		sample = g_get_real_time();
+	else
+		sample = g_get_monotonic_time();
+}
+
+/* Writes the timestamp of a new line in string, which must hold */
+/* TIMESTAMP_SIZE characters. Returns its length                  */
+guint timestamp_format(gchar *string, guint size)
+{
+	gint format = config.timestamp_format;
+	gint64 value, second;
+	guint ms, length;
+
+	if(format == TIMESTAMP_RELATIVE)
+		value = sample - session_start;
+	else if(format == TIMESTAMP_DELTA)
+	{
+		value = sample - (previous_line < 0 ? session_start : previous_line);
+		previous_line = sample;
+	}
+	else
+		value = sample;
+
+	value = MAX(value, 0);
+	second = value / G_USEC_PER_SEC;
+	ms = (value % G_USEC_PER_SEC) / 1000;
+
+	if(!cache.valid || cache.format != format || cache.second != second)
+		format_prefix(format, second);
+
+	length = cache.prefix_length + 3 + cache.suffix_length;
+	if(length > size)
+		return 0;
+
+	memcpy(string, cache.prefix, cache.prefix_length);
+	string += cache.prefix_length;
+	string[0] = '0' + ms / 100;
+	string[1] = '0' + ms / 10 % 10;
+	string[2] = '0' + ms % 10;
+	memcpy(string + 3, cache.suffix, cache.suffix_length);
+
+	return length;
+}
+
+/* -1 if the name is not known */
+gint timestamp_format_from_name(const gchar *name)
+{
+	gint i;
+
+	for(i = 0; i < TIMESTAMP_FORMATS_NUMBER; i++)
+	{
+		if(g_ascii_strcasecmp(name, format_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+const gchar *timestamp_format_name(gint format)
+{
+	if(format < 0 || format >= TIMESTAMP_FORMATS_NUMBER)
+		format = DEFAULT_TIMESTAMP_FORMAT;
+
+	return format_names[format];
+}
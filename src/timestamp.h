@@ -0,0 +1,38 @@
+/***********************************************************************/
+/* timestamp.h                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Formatting of the timestamps put in front of received lines    */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+#define TIMESTAMP_SIZE 64
+
+enum
+{
+	TIMESTAMP_EPOCH,             /* [days.hh.mm.ss.ms] since the epoch */
+	TIMESTAMP_LOCAL,             /* [hh:mm:ss.ms] local time */
+	TIMESTAMP_ISO8601,           /* [yyyy-mm-ddThh:mm:ss.ms+hh:mm] */
+	TIMESTAMP_RELATIVE,          /* [+s.ms] since the port was opened */
+	TIMESTAMP_DELTA,             /* [+s.ms] since the previous line */
+	TIMESTAMP_FORMATS_NUMBER
+};
+
+#define DEFAULT_TIMESTAMP_FORMAT TIMESTAMP_EPOCH
+
+void timestamp_reset(void);
+void timestamp_sample(void);
+guint timestamp_format(gchar *, guint);
+gint timestamp_format_from_name(const gchar *);
+const gchar *timestamp_format_name(gint);
+
+#endif
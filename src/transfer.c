@@ -0,0 +1,1786 @@
+/***********************************************************************/
+/* transfer.c                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      XMODEM, YMODEM and ZMODEM file transfers                       */
+/*                                                                     */
+/*      - XMODEM (CRC or checksum) and XMODEM-1K, one file             */
+/*      - YMODEM batch, with the names and sizes of the files          */
+/*      - ZMODEM, streamed with a window of unacknowledged data and    */
+/*        32-bit CRC when the receiver can check it                    */
+/*                                                                     */
+/*      Everything runs from the main loop: the received data is       */
+/*      handed over by serial.c while a transfer is running, and       */
+/*      what is sent goes through the transmission queue. ZMODEM       */
+/*      keeps the queue filled when the driver can take more, so the   */
+/*      transfer runs at the speed of the line.                        */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "term_config.h"
+#include "serial.h"
+#include "interface.h"
+#include "files.h"
+#include "crc.h"
+#include "transfer.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+#define SOH 0x01
+#define STX 0x02
+#define EOT 0x04
+#define ACK 0x06
+#define BS  0x08
+#define NAK 0x15
+#define CAN 0x18
+#define SUB 0x1A
+#define XON 0x11
+#define XOFF 0x13
+
+/* ZMODEM framing */
+#define ZPAD '*'
+#define ZDLE 0x18
+#define ZBIN 'A'
+#define ZHEX 'B'
+#define ZBIN32 'C'
+#define ZCRCE 'h'                     /* end of frame, header follows */
+#define ZCRCG 'i'                     /* frame continues */
+#define ZCRCQ 'j'                     /* frame continues, ZACK expected */
+#define ZCRCW 'k'                     /* end of frame, ZACK expected */
+#define ZRUB0 'l'
+#define ZRUB1 'm'
+
+/* ZMODEM frame types */
+enum
+{
+	ZRQINIT, ZRINIT, ZSINIT, ZACK, ZFILE, ZSKIP, ZNAK, ZABORT, ZFIN, ZRPOS,
+	ZDATA, ZEOF, ZFERR, ZCRC, ZCHALLENGE, ZCOMPL, ZCAN, ZFREECNT, ZCOMMAND
+};
+
+/* ZRINIT flags, in ZF0 */
+#define CANFDX 0x01
+#define CANOVIO 0x02
+#define CANFC32 0x20
+#define ESCCTL 0x40
+
+#define ZCBIN 1                       /* ZFILE: binary transfer */
+
+/* States of the transfer */
+enum
+{
+	XS_WAIT_START, XS_WAIT_ACK, XS_WAIT_EOT,
+	XR_START, XR_WAIT, XR_BLOCK, XR_PURGE,
+	ZS_WAIT_RINIT, ZS_WAIT_RPOS, ZS_SENDING, ZS_WAIT_ACK, ZS_WAIT_EOF, ZS_WAIT_FIN,
+	ZR_RECEIVING, ZR_FINISH
+};
+
+/* States of the ZMODEM parser */
+enum
+{
+	ZP_IDLE, ZP_PAD, ZP_PAD_ZDLE, ZP_HEX, ZP_BIN, ZP_DATA, ZP_DATA_CRC
+};
+
+static gint protocol = TRANSFER_RAW;  /* TRANSFER_RAW: no transfer */
+static gboolean sending;
+static gint state;
+static guint timeout_id = 0;
+static guint retries;
+static guint can_count;
+static gboolean ending = FALSE;
+static gint end_type;
+static gchar *end_message = NULL;
+
+/* Files sent */
+static GSList *files = NULL;          /* still to send */
+static GMappedFile *mapped = NULL;
+static const guint8 *file_data;
+static gsize file_size;
+static time_t file_mtime;
+static gchar *file_name = NULL;       /* NULL when there is no more */
+static gsize files_total;
+
+/* Files received */
+static gchar *receive_path = NULL;    /* folder, or file with XMODEM */
+static FILE *output = NULL;
+
+/* Both */
+static gsize file_pos;                /* sent or received up to here */
+static gsize files_done;              /* bytes of the previous files */
+static guint files_count;
+
+/* XMODEM / YMODEM */
+static guint8 block[1024 + 5];
+static guint block_length;            /* with the header and the CRC */
+static guint block_data;              /* bytes of the file in the block */
+static guint8 block_number;
+static guint8 expected;
+static guint block_received;
+static gboolean started;              /* a block has been received */
+static gboolean crc_mode;
+static gboolean header_next;          /* YMODEM: block 0 comes next */
+static guint eot_count;
+static guint8 held[1024];             /* XMODEM: last block, padding stripped at the end */
+static guint held_length;
+
+/* ZMODEM */
+static gboolean zcrc32;               /* for what is sent */
+static gboolean zescctl;
+static gboolean zblocking;            /* the receiver cannot take data while writing */
+static gsize zwindow;
+static gsize zrate;                   /* of the line, in bytes/s */
+static gsize ztx_low;
+static gsize zacked;
+static gboolean zframe_open;          /* a ZDATA frame is being sent */
+static guint8 zlast;                  /* last byte sent */
+static guint zpump_id = 0;
+static GByteArray *zout = NULL;
+static guint zfinish;                 /* 'O' received at the end */
+
+static gint zparse;
+static gboolean zdle_seen;
+static guint8 zformat;
+static guint8 zheader[9];
+static guint zheader_length;
+static guint8 zdata[ZMODEM_MAX_SUBPACKET];
+static guint zdata_length;
+static guint8 zdata_end;
+static gboolean zdata_crc32;
+static gint zdata_for;                /* ZFILE, ZDATA or ZSINIT */
+
+/* Statistics of the last transfer */
+static gint last_protocol = TRANSFER_RAW;
+static gboolean last_sending;
+static guint last_files;
+static guint64 last_bytes;
+static guint last_errors;
+static gint64 last_start;
+static gint64 last_end;
+
+extern struct configuration_port config;
+
+static const gchar *protocol_name(gint type)
+{
+	switch(type)
+	{
+	case TRANSFER_XMODEM:
+		return "XMODEM";
+	case TRANSFER_XMODEM_1K:
+		return "XMODEM-1K";
+	case TRANSFER_YMODEM:
+		return "YMODEM";
+	case TRANSFER_ZMODEM:
+		return "ZMODEM";
+	}
+	return _("Raw");
+}
+
+static void update_progress(gboolean force)
+{
+	gsize done = files_done + file_pos;
+
+	if(sending)
+	{
+		/* what is still in the transmission queue is not sent yet */
+		done -= MIN(file_pos, serial_tx_queued());
+		progress_window_update(done, files_total, force);
+	}
+	else if(output != NULL && file_size != 0)
+		progress_window_update(done, files_done + file_size, force);
+	else
+		progress_window_update(done, 0, force);
+}
+
+static gboolean transfer_end(gpointer data)
+{
+	gchar *msg;
+
+	if(mapped != NULL)
+		g_mapped_file_unref(mapped);
+	mapped = NULL;
+	g_slist_free_full(files, g_free);
+	files = NULL;
+	g_free(file_name);
+	file_name = NULL;
+
+	if(output != NULL)
+		fclose(output);
+	output = NULL;
+	g_free(receive_path);
+	receive_path = NULL;
+
+	progress_window_close();
+
+	if(end_type == MSG_ERR)
+	{
+		msg = g_strdup_printf(_("%s transfer failed: %s\n"), protocol_name(protocol), end_message);
+		show_message(msg, MSG_ERR);
+	}
+	else if(end_message != NULL)
+	{
+		msg = g_strdup_printf(_("%s transfer: %s"), protocol_name(protocol), end_message);
+		Put_temp_message(msg, 10000);
+	}
+	else
+	{
+		msg = g_strdup_printf(_("%s: %u file(s), %.1f KiB %s in %.1f s"),
+		                      protocol_name(protocol), last_files, (gdouble)last_bytes / 1024,
+		                      sending ? _("sent") : _("received"),
+		                      (gdouble)(last_end - last_start) / G_USEC_PER_SEC);
+		Put_temp_message(msg, 10000);
+	}
+	g_free(msg);
+	g_free(end_message);
+	end_message = NULL;
+
+	protocol = TRANSFER_RAW;
+	ending = FALSE;
+
+	return FALSE;
+}
+
+/* The transfer is ended from the main loop, not from the function */
+/* that is handling the received data or a timeout                 */
+static void transfer_stop(gint type, gchar *message)
+{
+	if(ending)
+	{
+		g_free(message);
+		return;
+	}
+	ending = TRUE;
+	end_type = type;
+	end_message = message;
+
+	if(timeout_id != 0)
+		g_source_remove(timeout_id);
+	timeout_id = 0;
+	if(zpump_id != 0)
+		g_source_remove(zpump_id);
+	zpump_id = 0;
+
+	last_files = files_count;
+	last_bytes = files_done + file_pos;
+	last_end = g_get_monotonic_time();
+
+	update_progress(TRUE);
+	g_idle_add(transfer_end, NULL);
+}
+
+static void send_bytes(const guint8 *data, gsize length)
+{
+	gint written;
+
+	if(ending)
+		return;
+
+	/* not send_serial(): the frames must not be echoed */
+	written = Send_chars((gchar *)data, length);
+	if(written == -1)
+		transfer_stop(MSG_ERR, g_strdup_printf(_("cannot send: %s"), strerror(errno)));
+	else if(written != (gint)length)
+		transfer_stop(MSG_ERR, g_strdup(_("cannot send: the transmission queue is full")));
+}
+
+static void send_byte(guint8 c)
+{
+	send_bytes(&c, 1);
+}
+
+/* Eight CAN, then backspaces to erase them from a command line */
+static void send_cancel(void)
+{
+	guint8 cancel[16];
+
+	memset(cancel, CAN, 8);
+	memset(cancel + 8, BS, 8);
+	serial_tx_discard();
+	send_bytes(cancel, sizeof(cancel));
+}
+
+static gboolean transfer_cancel(void)
+{
+	if(protocol != TRANSFER_RAW && !ending)
+	{
+		send_cancel();
+		transfer_stop(MSG_INF, g_strdup(_("cancelled")));
+	}
+
+	/* the window is destroyed with the transfer */
+	return TRUE;
+}
+
+static gboolean transfer_timeout(gpointer data);
+
+static void arm_timeout(guint delay)
+{
+	if(timeout_id != 0)
+		g_source_remove(timeout_id);
+	timeout_id = g_timeout_add(delay, transfer_timeout, NULL);
+}
+
+static gboolean remote_cancelled(guint8 c, guint needed)
+{
+	if(c != CAN)
+	{
+		can_count = 0;
+		return FALSE;
+	}
+
+	if(++can_count < needed)
+		return FALSE;
+
+	transfer_stop(MSG_ERR, g_strdup(_("cancelled by the remote")));
+	return TRUE;
+}
+
+static gboolean too_many_errors(void)
+{
+	last_errors++;
+	if(++retries <= TRANSFER_RETRIES)
+		return FALSE;
+
+	send_cancel();
+	transfer_stop(MSG_ERR, g_strdup(_("too many errors")));
+	return TRUE;
+}
+
+
+/*********************************************************************/
+/* Files                                                             */
+/*********************************************************************/
+
+/* Maps the next file to send, file_name is NULL when there is none */
+static void next_file(void)
+{
+	GError *error = NULL;
+	GStatBuf file_stat;
+	gchar *path, *msg;
+
+	if(mapped != NULL)
+	{
+		files_done += file_size;
+		g_mapped_file_unref(mapped);
+		mapped = NULL;
+	}
+	g_free(file_name);
+	file_name = NULL;
+	file_data = NULL;
+	file_size = 0;
+	file_pos = 0;
+
+	if(files == NULL)
+		return;
+
+	path = files->data;
+	files = g_slist_delete_link(files, files);
+
+	mapped = g_mapped_file_new(path, FALSE, &error);
+	if(mapped == NULL)
+	{
+		transfer_stop(MSG_ERR, g_strdup_printf(_("cannot read file %s: %s"), path, error->message));
+		g_error_free(error);
+		g_free(path);
+		return;
+	}
+
+	file_data = (const guint8 *)g_mapped_file_get_contents(mapped);
+	file_size = g_mapped_file_get_length(mapped);
+	file_mtime = g_stat(path, &file_stat) == 0 ? file_stat.st_mtime : 0;
+	file_name = g_path_get_basename(path);
+
+	msg = g_strdup_printf(_("%s : %s transfer in progress..."), path, protocol_name(protocol));
+	progress_window_set_title(msg);
+	g_free(msg);
+	g_free(path);
+}
+
+/* The names come from the sender: only the last part is used, */
+/* and an existing file is not overwritten                     */
+static gboolean open_output(const gchar *name, gsize size)
+{
+	gchar *base, *path, *msg;
+	guint i;
+
+	base = g_path_get_basename(name);
+	if(base[0] == 0 || !strcmp(base, ".") || !strcmp(base, "..") || !strcmp(base, G_DIR_SEPARATOR_S))
+	{
+		g_free(base);
+		base = g_strdup("received");
+	}
+
+	path = g_build_filename(receive_path, base, NULL);
+	for(i = 1; g_file_test(path, G_FILE_TEST_EXISTS); i++)
+	{
+		g_free(path);
+		path = g_strdup_printf("%s%c%s.%u", receive_path, G_DIR_SEPARATOR, base, i);
+	}
+	g_free(base);
+
+	output = g_fopen(path, "wb");
+	if(output == NULL)
+	{
+		transfer_stop(MSG_ERR, g_strdup_printf(_("cannot open file %s: %s"), path, strerror(errno)));
+		g_free(path);
+		return FALSE;
+	}
+
+	file_pos = 0;
+	file_size = size;
+
+	msg = g_strdup_printf(_("%s : %s transfer in progress..."), path, protocol_name(protocol));
+	progress_window_set_title(msg);
+	g_free(msg);
+	g_free(path);
+
+	return TRUE;
+}
+
+static gboolean write_output(const guint8 *data, gsize length)
+{
+	if(length == 0 || fwrite(data, length, 1, output) == 1)
+		return TRUE;
+
+	send_cancel();
+	transfer_stop(MSG_ERR, g_strdup_printf(_("cannot write the file: %s"), strerror(errno)));
+	return FALSE;
+}
+
+static void close_output(void)
+{
+	if(output == NULL)
+		return;
+
+	if(fclose(output) != 0)
+		transfer_stop(MSG_ERR, g_strdup_printf(_("cannot write the file: %s"), strerror(errno)));
+	output = NULL;
+
+	files_count++;
+	files_done += file_pos;
+	file_pos = 0;
+	file_size = 0;
+}
+
+
+/*********************************************************************/
+/* XMODEM / YMODEM, sender                                           */
+/*********************************************************************/
+
+static void xmodem_build_block(guint8 number, const guint8 *data, guint length, guint size, guint8 padding)
+{
+	guint16 crc;
+	guint8 sum = 0;
+	guint i;
+
+	block[0] = size == 1024 ? STX : SOH;
+	block[1] = number;
+	block[2] = ~number;
+	memcpy(block + 3, data, length);
+	memset(block + 3 + length, padding, size - length);
+
+	if(crc_mode)
+	{
+		crc = crc16_update(0, block + 3, size);
+		block[3 + size] = crc >> 8;
+		block[4 + size] = crc & 0xff;
+		block_length = size + 5;
+	}
+	else
+	{
+		for(i = 0; i < size; i++)
+			sum += block[3 + i];
+		block[3 + size] = sum;
+		block_length = size + 4;
+	}
+}
+
+static void xmodem_send_block(void)
+{
+	send_bytes(block, block_length);
+	state = XS_WAIT_ACK;
+	arm_timeout(TRANSFER_TIMEOUT);
+}
+
+static void xmodem_send_eot(void)
+{
+	send_byte(EOT);
+	state = XS_WAIT_EOT;
+	arm_timeout(TRANSFER_TIMEOUT);
+}
+
+/* Block 0: name, size and date of the file, empty at the end */
+static void ymodem_send_header(void)
+{
+	guint8 header[1024];
+	guint length = 0;
+
+	memset(header, 0, sizeof(header));
+	if(file_name != NULL)
+	{
+		g_strlcpy((gchar *)header, file_name, sizeof(header) - 64);
+		length = strlen((gchar *)header) + 1;
+		length += g_snprintf((gchar *)header + length, sizeof(header) - length,
+		                     "%" G_GSIZE_FORMAT " %lo", file_size, (gulong)file_mtime) + 1;
+	}
+
+	block_data = 0;
+	xmodem_build_block(0, header, length, length > 128 ? 1024 : 128, 0);
+	xmodem_send_block();
+}
+
+static void xmodem_send_next(void)
+{
+	gsize left = file_size - file_pos;
+	guint size;
+
+	if(left == 0)
+	{
+		xmodem_send_eot();
+		return;
+	}
+
+	/* short blocks at the end, to pad less */
+	size = (protocol != TRANSFER_XMODEM && left > 768) ? 1024 : 128;
+	block_data = MIN(left, size);
+	xmodem_build_block(block_number, file_data + file_pos, block_data, size, SUB);
+	xmodem_send_block();
+}
+
+static void xmodem_sender(guint8 c)
+{
+	if(remote_cancelled(c, 2))
+		return;
+
+	switch(state)
+	{
+	case XS_WAIT_START:
+		if(c != 'C' && c != NAK)
+			break;
+		crc_mode = (c == 'C');
+		retries = 0;
+		if(header_next)
+			ymodem_send_header();
+		else
+		{
+			block_number = 1;
+			xmodem_send_next();
+		}
+		break;
+
+	case XS_WAIT_ACK:
+		if(c == ACK)
+		{
+			retries = 0;
+			if(header_next)
+			{
+				/* the receiver asks for the data with a 'C' */
+				header_next = FALSE;
+				if(file_name == NULL)
+					transfer_stop(MSG_INF, NULL);
+				else
+				{
+					state = XS_WAIT_START;
+					arm_timeout(TRANSFER_TIMEOUT);
+				}
+				break;
+			}
+			file_pos += block_data;
+			block_number++;
+			xmodem_send_next();
+		}
+		else if((c == NAK || (c == 'C' && (header_next || block_number == 1))) && !too_many_errors())
+			xmodem_send_block();
+		break;
+
+	case XS_WAIT_EOT:
+		if(c == NAK)
+			xmodem_send_eot();
+		else if(c == ACK)
+		{
+			files_count++;
+			if(protocol != TRANSFER_YMODEM)
+			{
+				files_done += file_size;
+				file_pos = 0;
+				transfer_stop(MSG_INF, NULL);
+				break;
+			}
+			next_file();
+			header_next = TRUE;
+			state = XS_WAIT_START;
+			arm_timeout(TRANSFER_TIMEOUT);
+		}
+		break;
+	}
+}
+
+
+/*********************************************************************/
+/* XMODEM / YMODEM, receiver                                         */
+/*********************************************************************/
+
+static void xmodem_receive_start(void)
+{
+	send_byte('C');
+	state = XR_START;
+	arm_timeout(XMODEM_START_PERIOD);
+}
+
+/* Block 0: an empty name ends the batch */
+static void ymodem_header(const guint8 *data, guint size)
+{
+	gchar header[1024 + 1];
+	gchar *name_end;
+	gsize length = 0;
+
+	memcpy(header, data, size);
+	header[size] = 0;
+
+	if(header[0] == 0)
+	{
+		send_byte(ACK);
+		transfer_stop(MSG_INF, NULL);
+		return;
+	}
+
+	name_end = header + strlen(header) + 1;
+	if(name_end < header + size)
+		length = g_ascii_strtoull(name_end, NULL, 10);
+
+	if(!open_output(header, length))
+		return;
+
+	header_next = FALSE;
+	expected = 1;
+	eot_count = 0;
+	send_byte(ACK);
+	xmodem_receive_start();
+}
+
+/* After an error, what the sender had already sent is dropped, */
+/* or the blocks sent again would not be found                  */
+static void xmodem_purge(void)
+{
+	state = XR_PURGE;
+	arm_timeout(XMODEM_PURGE_TIMEOUT);
+}
+
+static void xmodem_block(void)
+{
+	guint size = block_length - 5;
+	guint8 *data = block + 3;
+	guint16 crc;
+	guint length;
+
+	state = XR_WAIT;
+	arm_timeout(TRANSFER_TIMEOUT);
+
+	crc = crc16_update(0, data, size);
+	if((guint8)(block[1] ^ block[2]) != 0xff || crc != ((data[size] << 8) | data[size + 1]))
+	{
+		if(!too_many_errors())
+			xmodem_purge();
+		return;
+	}
+
+	started = TRUE;
+
+	if(header_next)
+	{
+		if(block[1] == 0)
+			ymodem_header(data, size);
+		else if(!too_many_errors())
+			send_byte(NAK);
+		return;
+	}
+
+	/* our ACK was lost */
+	if(block[1] == (guint8)(expected - 1))
+	{
+		send_byte(ACK);
+		return;
+	}
+
+	if(block[1] != expected)
+	{
+		send_cancel();
+		transfer_stop(MSG_ERR, g_strdup(_("synchronization lost")));
+		return;
+	}
+
+	if(protocol == TRANSFER_YMODEM && file_size != 0)
+	{
+		/* the size is known, the padding is dropped */
+		length = MIN(size, file_size - MIN(file_pos, file_size));
+		if(!write_output(data, length))
+			return;
+	}
+	else
+	{
+		/* the padding can only be told apart at the end */
+		if(!write_output(held, held_length))
+			return;
+		memcpy(held, data, size);
+		held_length = size;
+		length = size;
+	}
+
+	file_pos += length;
+	expected++;
+	eot_count = 0;
+	retries = 0;
+	send_byte(ACK);
+}
+
+static void xmodem_eot(void)
+{
+	/* YMODEM: the first one can be noise */
+	if(protocol == TRANSFER_YMODEM && eot_count++ == 0)
+	{
+		send_byte(NAK);
+		arm_timeout(TRANSFER_TIMEOUT);
+		return;
+	}
+
+	if(held_length != 0)
+	{
+		while(held_length > 0 && held[held_length - 1] == SUB)
+		{
+			held_length--;
+			file_pos--;
+		}
+		if(!write_output(held, held_length))
+			return;
+		held_length = 0;
+	}
+
+	send_byte(ACK);
+	close_output();
+
+	if(protocol == TRANSFER_YMODEM)
+	{
+		header_next = TRUE;
+		xmodem_receive_start();
+	}
+	else
+		transfer_stop(MSG_INF, NULL);
+}
+
+static void xmodem_receiver(guint8 c)
+{
+	switch(state)
+	{
+	case XR_START:
+	case XR_WAIT:
+		if(c == SOH || c == STX)
+		{
+			block[0] = c;
+			block_length = (c == STX ? 1024 : 128) + 5;
+			block_received = 1;
+			state = XR_BLOCK;
+			arm_timeout(TRANSFER_TIMEOUT);
+		}
+		else if(c == EOT && !header_next)
+			xmodem_eot();  /* even before any block: empty file */
+		else if(!remote_cancelled(c, 2) && c != CAN && state == XR_WAIT)
+			xmodem_purge();
+		break;
+
+	case XR_PURGE:
+		if(!remote_cancelled(c, 2))
+			arm_timeout(XMODEM_PURGE_TIMEOUT);
+		break;
+
+	case XR_BLOCK:
+		block[block_received++] = c;
+		if(block_received == block_length)
+			xmodem_block();
+		break;
+	}
+}
+
+
+/*********************************************************************/
+/* ZMODEM, encoding                                                  */
+/*********************************************************************/
+
+static void zput(guint8 c)
+{
+	g_byte_array_append(zout, &c, 1);
+	zlast = c;
+}
+
+/* ZDLE and the flow control characters are always escaped, CR after */
+/* '@' too, to get through telnet. Control characters on request     */
+static void zput_escaped(guint8 c)
+{
+	guint8 low = c & 0x7f;
+
+	if(c == ZDLE || low == 0x10 || low == XON || low == XOFF ||
+	   (low == '\r' && (zlast & 0x7f) == '@') || (zescctl && (c & 0x60) == 0))
+	{
+		zput(ZDLE);
+		zput(c ^ 0x40);
+	}
+	else if(zescctl && low == 0x7f)
+	{
+		zput(ZDLE);
+		zput(c == 0x7f ? ZRUB0 : ZRUB1);
+	}
+	else
+		zput(c);
+}
+
+static void zflush(void)
+{
+	send_bytes(zout->data, zout->len);
+	g_byte_array_set_size(zout, 0);
+}
+
+static void zheader_fill(guint8 *header, guint8 type, guint32 pos)
+{
+	header[0] = type;
+	header[1] = pos & 0xff;
+	header[2] = (pos >> 8) & 0xff;
+	header[3] = (pos >> 16) & 0xff;
+	header[4] = pos >> 24;
+}
+
+static void zsend_hex_header(guint8 type, guint32 pos)
+{
+	static const gchar digits[] = "0123456789abcdef";
+	guint8 header[7];
+	guint16 crc;
+	guint i;
+
+	zheader_fill(header, type, pos);
+	crc = crc16_update(0, header, 5);
+	header[5] = crc >> 8;
+	header[6] = crc & 0xff;
+
+	zput(ZPAD);
+	zput(ZPAD);
+	zput(ZDLE);
+	zput(ZHEX);
+	for(i = 0; i < 7; i++)
+	{
+		zput(digits[header[i] >> 4]);
+		zput(digits[header[i] & 0x0f]);
+	}
+	zput('\r');
+	zput('\n' | 0x80);
+	if(type != ZFIN && type != ZACK)
+		zput(XON);
+	zflush();
+}
+
+static void zsend_bin_header(guint8 type, guint32 pos)
+{
+	guint8 header[5];
+	guint32 crc32;
+	guint16 crc16;
+	guint i;
+
+	zheader_fill(header, type, pos);
+
+	zput(ZPAD);
+	zput(ZDLE);
+	if(zcrc32)
+	{
+		zput(ZBIN32);
+		for(i = 0; i < 5; i++)
+			zput_escaped(header[i]);
+		crc32 = ~crc32_update(0xFFFFFFFF, header, 5);
+		for(i = 0; i < 4; i++)
+			zput_escaped((crc32 >> (8 * i)) & 0xff);
+	}
+	else
+	{
+		zput(ZBIN);
+		for(i = 0; i < 5; i++)
+			zput_escaped(header[i]);
+		crc16 = crc16_update(0, header, 5);
+		zput_escaped(crc16 >> 8);
+		zput_escaped(crc16 & 0xff);
+	}
+	zflush();
+}
+
+static void zsend_data(const guint8 *data, gsize length, guint8 end)
+{
+	guint32 crc32;
+	guint16 crc16;
+	gsize i;
+
+	for(i = 0; i < length; i++)
+		zput_escaped(data[i]);
+	zput(ZDLE);
+	zput(end);
+
+	if(zcrc32)
+	{
+		crc32 = crc32_update(0xFFFFFFFF, data, length);
+		crc32 = ~crc32_update(crc32, &end, 1);
+		for(i = 0; i < 4; i++)
+			zput_escaped((crc32 >> (8 * i)) & 0xff);
+	}
+	else
+	{
+		crc16 = crc16_update(0, data, length);
+		crc16 = crc16_update(crc16, &end, 1);
+		zput_escaped(crc16 >> 8);
+		zput_escaped(crc16 & 0xff);
+	}
+
+	if(end == ZCRCW)
+		zput(XON);
+	zflush();
+}
+
+static guint32 zheader_pos(void)
+{
+	return zheader[1] | (zheader[2] << 8) | (zheader[3] << 16) | ((guint32)zheader[4] << 24);
+}
+
+
+/*********************************************************************/
+/* ZMODEM, sender                                                    */
+/*********************************************************************/
+
+static void zmodem_send_file(void)
+{
+	gchar info[1024];
+	gsize length;
+
+	if(file_name == NULL)
+	{
+		zsend_hex_header(ZFIN, 0);
+		state = ZS_WAIT_FIN;
+		arm_timeout(TRANSFER_TIMEOUT);
+		return;
+	}
+
+	/* name, size, date, mode, serial number, files and bytes left */
+	g_strlcpy(info, file_name, sizeof(info) - 128);
+	length = strlen(info) + 1;
+	length += g_snprintf(info + length, sizeof(info) - length,
+	                     "%" G_GSIZE_FORMAT " %lo 100644 0 %u %" G_GSIZE_FORMAT,
+	                     file_size, (gulong)file_mtime, g_slist_length(files) + 1,
+	                     files_total - files_done) + 1;
+
+	zsend_bin_header(ZFILE, ZCBIN << 24);
+	zsend_data((guint8 *)info, length, ZCRCW);
+	state = ZS_WAIT_RPOS;
+	arm_timeout(TRANSFER_TIMEOUT);
+}
+
+static gboolean zmodem_pump(GIOChannel *src, GIOCondition cond, gpointer data);
+
+static void zmodem_start_pump(void)
+{
+	GIOChannel *channel;
+
+	state = ZS_SENDING;
+	if(zpump_id != 0)
+		return;
+
+	channel = g_io_channel_unix_new(serial_port_fd);
+	zpump_id = g_io_add_watch_full(channel, 10, G_IO_OUT, (GIOFunc)zmodem_pump, NULL, NULL);
+	g_io_channel_unref(channel);
+}
+
+static void zmodem_send_from(gsize pos)
+{
+	file_pos = MIN(pos, file_size);
+	zacked = file_pos;
+	zsend_bin_header(ZDATA, file_pos);
+	zframe_open = TRUE;
+	arm_timeout(TRANSFER_TIMEOUT);
+	zmodem_start_pump();
+}
+
+/* Called when the driver can take more: subpackets are added while */
+/* little is queued, so that a ZRPOS does not have much to drop     */
+static gboolean zmodem_pump(GIOChannel *src, GIOCondition cond, gpointer data)
+{
+	guint subpackets;
+	gsize length;
+	guint8 end;
+
+	for(subpackets = 0; subpackets < 16 && serial_tx_queued() < ztx_low && !ending; subpackets++)
+	{
+		if(file_pos == file_size && !zframe_open)
+		{
+			zsend_bin_header(ZEOF, file_pos);
+			state = ZS_WAIT_EOF;
+			zpump_id = 0;
+			arm_timeout(TRANSFER_TIMEOUT);
+			return FALSE;
+		}
+
+		if(file_pos - zacked >= zwindow)
+		{
+			state = ZS_WAIT_ACK;
+			zpump_id = 0;
+			return FALSE;
+		}
+
+		if(!zframe_open)
+		{
+			zsend_bin_header(ZDATA, file_pos);
+			zframe_open = TRUE;
+		}
+
+		length = MIN(ZMODEM_SUBPACKET, file_size - file_pos);
+		if(file_pos + length == file_size)
+			end = ZCRCE;
+		else if(zblocking && file_pos + length - zacked >= zwindow)
+			end = ZCRCW;
+		else if(!zblocking && (file_pos + length) % (zwindow / 4) < length)
+			end = ZCRCQ;
+		else
+			end = ZCRCG;
+
+		zsend_data(file_data + file_pos, length, end);
+		file_pos += length;
+		if(end == ZCRCE || end == ZCRCW)
+			zframe_open = FALSE;
+	}
+
+	update_progress(FALSE);
+
+	return !ending;
+}
+
+static void zmodem_stop_pump(void)
+{
+	if(zpump_id != 0)
+		g_source_remove(zpump_id);
+	zpump_id = 0;
+}
+
+static void zmodem_sender_header(guint8 type)
+{
+	guint32 pos = zheader_pos();
+
+	switch(type)
+	{
+	case ZRINIT:
+		zcrc32 = (zheader[4] & CANFC32) != 0;
+		zescctl = (zheader[4] & ESCCTL) != 0;
+		zwindow = zheader[1] | (zheader[2] << 8);
+		zblocking = zwindow != 0 || !(zheader[4] & CANFDX);
+		if(zwindow == 0)
+			zwindow = CLAMP(2 * zrate, 4 * ZMODEM_SUBPACKET, ZMODEM_WINDOW);
+
+		if(state == ZS_WAIT_EOF)
+		{
+			files_count++;
+			next_file();
+			if(ending)
+				break;
+		}
+		if(state == ZS_WAIT_RINIT || state == ZS_WAIT_RPOS || state == ZS_WAIT_EOF)
+		{
+			retries = 0;
+			zmodem_send_file();
+		}
+		break;
+
+	case ZRPOS:
+		if(state == ZS_WAIT_RINIT || state == ZS_WAIT_FIN)
+			break;
+		if(state != ZS_WAIT_RPOS)
+		{
+			/* further than before: the errors are not in a row */
+			if(pos > zacked)
+				retries = 0;
+			if(too_many_errors())
+				break;
+			zmodem_stop_pump();
+			serial_tx_discard();
+		}
+		zmodem_send_from(pos);
+		break;
+
+	case ZACK:
+		if(state != ZS_SENDING && state != ZS_WAIT_ACK)
+			break;
+		if(pos > zacked && pos <= file_pos)
+			zacked = pos;
+		retries = 0;
+		arm_timeout(TRANSFER_TIMEOUT);
+		zmodem_start_pump();
+		break;
+
+	case ZSKIP:
+		if(state == ZS_WAIT_RINIT || state == ZS_WAIT_FIN)
+			break;
+		zmodem_stop_pump();
+		serial_tx_discard();
+		zframe_open = FALSE;
+		next_file();
+		if(!ending)
+			zmodem_send_file();
+		break;
+
+	case ZNAK:
+		if(state == ZS_WAIT_RINIT)
+			zsend_hex_header(ZRQINIT, 0);
+		else if(state == ZS_WAIT_RPOS)
+			zmodem_send_file();
+		else if(state == ZS_WAIT_EOF)
+			zsend_bin_header(ZEOF, file_pos);
+		else if(state == ZS_WAIT_FIN)
+			zsend_hex_header(ZFIN, 0);
+		break;
+
+	case ZFIN:
+		if(state == ZS_WAIT_FIN)
+		{
+			send_bytes((const guint8 *)"OO", 2);
+			transfer_stop(MSG_INF, NULL);
+		}
+		break;
+
+	case ZCAN:
+	case ZABORT:
+	case ZFERR:
+		transfer_stop(MSG_ERR, g_strdup(_("cancelled by the remote")));
+		break;
+	}
+}
+
+
+/*********************************************************************/
+/* ZMODEM, receiver                                                  */
+/*********************************************************************/
+
+static void zmodem_send_rinit(void)
+{
+	/* no buffer limit: the data is written as it comes */
+	zsend_hex_header(ZRINIT, (guint32)(CANFDX | CANOVIO | CANFC32) << 24);
+	arm_timeout(TRANSFER_TIMEOUT);
+}
+
+static void zmodem_expect_data(gint frame)
+{
+	zdata_for = frame;
+	zdata_crc32 = (zformat == ZBIN32);
+	zdata_length = 0;
+	zdle_seen = FALSE;
+	zparse = ZP_DATA;
+}
+
+static void zmodem_receiver_header(guint8 type)
+{
+	switch(type)
+	{
+	case ZRQINIT:
+		if(output == NULL)
+			zmodem_send_rinit();
+		break;
+
+	case ZSINIT:
+	case ZFILE:
+		zmodem_expect_data(type);
+		break;
+
+	case ZDATA:
+		if(output == NULL)
+		{
+			zmodem_send_rinit();
+			break;
+		}
+		if(zheader_pos() != file_pos)
+		{
+			/* the data until the next header is ignored */
+			if(!too_many_errors())
+				zsend_hex_header(ZRPOS, file_pos);
+			break;
+		}
+		zmodem_expect_data(ZDATA);
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+
+	case ZEOF:
+		if(output == NULL || zheader_pos() != file_pos)
+			break;
+		close_output();
+		zmodem_send_rinit();
+		break;
+
+	case ZFIN:
+		zsend_hex_header(ZFIN, 0);
+		state = ZR_FINISH;
+		zfinish = 0;
+		arm_timeout(ZMODEM_FINISH_TIMEOUT);
+		break;
+
+	case ZNAK:
+		zmodem_send_rinit();
+		break;
+
+	case ZCAN:
+	case ZABORT:
+		transfer_stop(MSG_ERR, g_strdup(_("cancelled by the remote")));
+		break;
+
+	case ZFREECNT:
+		/* no idea of the free space */
+		zsend_hex_header(ZACK, 0);
+		break;
+
+	case ZCOMMAND:
+		/* commands are not run */
+		zsend_hex_header(ZCOMPL, 0);
+		break;
+	}
+}
+
+static void zmodem_receiver_data(void)
+{
+	gchar *size;
+
+	switch(zdata_for)
+	{
+	case ZSINIT:
+		zsend_hex_header(ZACK, 0);
+		zparse = ZP_IDLE;
+		break;
+
+	case ZFILE:
+		zparse = ZP_IDLE;
+		zdata[MIN(zdata_length, ZMODEM_MAX_SUBPACKET - 1)] = 0;
+		size = (gchar *)zdata + strlen((gchar *)zdata) + 1;
+		if(output == NULL && !open_output((gchar *)zdata,
+		                                  size < (gchar *)zdata + zdata_length ? g_ascii_strtoull(size, NULL, 10) : 0))
+			break;
+		retries = 0;
+		zsend_hex_header(ZRPOS, file_pos);
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+
+	case ZDATA:
+		if(!write_output(zdata, zdata_length))
+			break;
+		file_pos += zdata_length;
+		retries = 0;
+		arm_timeout(TRANSFER_TIMEOUT);
+
+		if(zdata_end == ZCRCW || zdata_end == ZCRCQ)
+			zsend_hex_header(ZACK, file_pos);
+		if(zdata_end == ZCRCW || zdata_end == ZCRCE)
+			zparse = ZP_IDLE;
+		break;
+	}
+
+	zdata_length = 0;
+}
+
+static void zmodem_data_error(void)
+{
+	zparse = ZP_IDLE;
+	if(too_many_errors())
+		return;
+
+	if(zdata_for == ZDATA)
+		zsend_hex_header(ZRPOS, file_pos);
+	else
+		zsend_hex_header(ZNAK, 0);
+}
+
+
+/*********************************************************************/
+/* ZMODEM, parser                                                    */
+/*********************************************************************/
+
+/* The byte, -1 after a ZDLE, -2 on a bad escape, 0x100 | end of a subpacket */
+static gint zunescape(guint8 c)
+{
+	if(!zdle_seen)
+	{
+		if(c != ZDLE)
+			return c;
+		zdle_seen = TRUE;
+		return -1;
+	}
+	zdle_seen = FALSE;
+
+	switch(c)
+	{
+	case ZCRCE:
+	case ZCRCG:
+	case ZCRCQ:
+	case ZCRCW:
+		return 0x100 | c;
+	case ZRUB0:
+		return 0x7f;
+	case ZRUB1:
+		return 0xff;
+	}
+
+	if((c & 0x60) == 0x40)
+		return c ^ 0x40;
+
+	return -2;
+}
+
+static gboolean zheader_valid(void)
+{
+	guint32 crc32;
+	guint16 crc16;
+
+	if(zformat == ZBIN32)
+	{
+		crc32 = ~crc32_update(0xFFFFFFFF, zheader, 5);
+		return crc32 == (zheader[5] | (zheader[6] << 8) | (zheader[7] << 16) | ((guint32)zheader[8] << 24));
+	}
+
+	crc16 = crc16_update(0, zheader, 5);
+	return crc16 == ((zheader[5] << 8) | zheader[6]);
+}
+
+static gboolean zdata_valid(void)
+{
+	const guint8 *crc = zheader;
+	guint32 crc32;
+	guint16 crc16;
+
+	if(zdata_crc32)
+	{
+		crc32 = crc32_update(0xFFFFFFFF, zdata, zdata_length);
+		crc32 = ~crc32_update(crc32, &zdata_end, 1);
+		return crc32 == (crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((guint32)crc[3] << 24));
+	}
+
+	crc16 = crc16_update(0, zdata, zdata_length);
+	crc16 = crc16_update(crc16, &zdata_end, 1);
+	return crc16 == ((crc[0] << 8) | crc[1]);
+}
+
+static void zmodem_header_received(void)
+{
+	zparse = ZP_IDLE;
+
+	if(!zheader_valid())
+	{
+		if(!too_many_errors() && !sending)
+			zsend_hex_header(ZNAK, 0);
+		return;
+	}
+
+	if(sending)
+		zmodem_sender_header(zheader[0]);
+	else
+		zmodem_receiver_header(zheader[0]);
+}
+
+static void zmodem_byte(guint8 c)
+{
+	gint value;
+
+	if(remote_cancelled(c, 5))
+		return;
+
+	/* the sender ends with "OO" */
+	if(state == ZR_FINISH)
+	{
+		if(c == 'O' && ++zfinish == 2)
+			transfer_stop(MSG_INF, NULL);
+		return;
+	}
+
+	/* never part of the data, they are always escaped */
+	if((c & 0x7f) == XON || (c & 0x7f) == XOFF)
+		return;
+
+	switch(zparse)
+	{
+	case ZP_IDLE:
+		if(c == ZPAD)
+			zparse = ZP_PAD;
+		break;
+
+	case ZP_PAD:
+		if(c == ZDLE)
+			zparse = ZP_PAD_ZDLE;
+		else if(c != ZPAD)
+			zparse = ZP_IDLE;
+		break;
+
+	case ZP_PAD_ZDLE:
+		zformat = c;
+		zheader_length = 0;
+		zdle_seen = FALSE;
+		if(c == ZHEX)
+			zparse = ZP_HEX;
+		else if(c == ZBIN || c == ZBIN32)
+			zparse = ZP_BIN;
+		else
+			zparse = ZP_IDLE;
+		break;
+
+	case ZP_HEX:
+		if(!g_ascii_isxdigit(c))
+		{
+			zparse = ZP_IDLE;
+			break;
+		}
+		if(zheader_length % 2 == 0)
+			zheader[zheader_length / 2] = g_ascii_xdigit_value(c) << 4;
+		else
+			zheader[zheader_length / 2] |= g_ascii_xdigit_value(c);
+		if(++zheader_length == 14)
+			zmodem_header_received();
+		break;
+
+	case ZP_BIN:
+		value = zunescape(c);
+		if(value == -1)
+			break;
+		if(value < 0 || value > 0xff)
+		{
+			zparse = ZP_IDLE;
+			break;
+		}
+		zheader[zheader_length++] = value;
+		if(zheader_length == (zformat == ZBIN32 ? 9 : 7))
+			zmodem_header_received();
+		break;
+
+	case ZP_DATA:
+		value = zunescape(c);
+		if(value == -1)
+			break;
+		if(value == -2 || (value <= 0xff && zdata_length == ZMODEM_MAX_SUBPACKET))
+		{
+			zmodem_data_error();
+			break;
+		}
+		if(value > 0xff)
+		{
+			zdata_end = value & 0xff;
+			zheader_length = 0;
+			zparse = ZP_DATA_CRC;
+			break;
+		}
+		zdata[zdata_length++] = value;
+		break;
+
+	case ZP_DATA_CRC:
+		value = zunescape(c);
+		if(value == -1)
+			break;
+		if(value < 0 || value > 0xff)
+		{
+			zmodem_data_error();
+			break;
+		}
+		/* the header buffer is free while data is read */
+		zheader[zheader_length++] = value;
+		if(zheader_length < (zdata_crc32 ? 4u : 2u))
+			break;
+		if(!zdata_valid())
+		{
+			zmodem_data_error();
+			break;
+		}
+		zparse = ZP_DATA;
+		zmodem_receiver_data();
+		break;
+	}
+}
+
+
+/*********************************************************************/
+/* Transfers                                                         */
+/*********************************************************************/
+
+static gboolean transfer_timeout(gpointer data)
+{
+	timeout_id = 0;
+
+	if(state == ZR_FINISH)
+	{
+		transfer_stop(MSG_INF, NULL);
+		return FALSE;
+	}
+
+	/* the line is quiet again */
+	if(state == XR_PURGE)
+	{
+		send_byte(expected == 1 && !header_next ? 'C' : NAK);
+		state = XR_WAIT;
+		arm_timeout(TRANSFER_TIMEOUT);
+		return FALSE;
+	}
+
+	/* waiting for the remote to be started */
+	if(state == XR_START && !started && retries < XMODEM_START_RETRIES)
+	{
+		retries++;
+		xmodem_receive_start();
+		return FALSE;
+	}
+
+	if(too_many_errors())
+		return FALSE;
+
+	switch(state)
+	{
+	case XS_WAIT_START:
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+	case XS_WAIT_ACK:
+		xmodem_send_block();
+		break;
+	case XS_WAIT_EOT:
+		xmodem_send_eot();
+		break;
+	case XR_START:
+		xmodem_receive_start();
+		break;
+	case XR_WAIT:
+	case XR_BLOCK:
+		/* no 'C' is sent after a NAK, and the sender would take it for the checksum mode */
+		send_byte(expected == 1 && !header_next ? 'C' : NAK);
+		state = XR_WAIT;
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+	case ZS_WAIT_RINIT:
+		zsend_hex_header(ZRQINIT, 0);
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+	case ZS_WAIT_RPOS:
+		zmodem_send_file();
+		break;
+	case ZS_SENDING:
+	case ZS_WAIT_ACK:
+		/* start again from what the receiver has */
+		zmodem_stop_pump();
+		serial_tx_discard();
+		zmodem_send_from(zacked);
+		break;
+	case ZS_WAIT_EOF:
+		zsend_bin_header(ZEOF, file_pos);
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+	case ZS_WAIT_FIN:
+		zsend_hex_header(ZFIN, 0);
+		arm_timeout(TRANSFER_TIMEOUT);
+		break;
+	case ZR_RECEIVING:
+		zparse = ZP_IDLE;
+		if(output == NULL)
+			zmodem_send_rinit();
+		else
+		{
+			zsend_hex_header(ZRPOS, file_pos);
+			arm_timeout(TRANSFER_TIMEOUT);
+		}
+		break;
+	}
+
+	return FALSE;
+}
+
+static gboolean transfer_begin(gint type, gboolean send)
+{
+	gchar *msg;
+
+	if(protocol != TRANSFER_RAW)
+		return FALSE;
+
+	if(serial_port_fd == -1)
+	{
+		show_message(_("The port is not open"), MSG_ERR);
+		return FALSE;
+	}
+
+	protocol = type;
+	sending = send;
+	retries = 0;
+	can_count = 0;
+	file_pos = 0;
+	file_size = 0;
+	files_done = 0;
+	files_count = 0;
+	held_length = 0;
+	eot_count = 0;
+	expected = 1;
+	started = FALSE;
+	crc_mode = TRUE;
+	header_next = (type == TRANSFER_YMODEM);
+
+	zparse = ZP_IDLE;
+	zdle_seen = FALSE;
+	zcrc32 = FALSE;
+	zescctl = FALSE;
+	zframe_open = FALSE;
+	zlast = 0;
+	/* about two seconds of unacknowledged data at most, ZMODEM_WINDOW at high speeds */
+	zrate = MAX(config.vitesse / 10, 1);
+	ztx_low = CLAMP(zrate / 4, ZMODEM_SUBPACKET, ZMODEM_TX_LOW);
+	if(zout == NULL)
+		zout = g_byte_array_sized_new(2 * ZMODEM_SUBPACKET + 32);
+
+	last_protocol = type;
+	last_sending = send;
+	last_errors = 0;
+	last_start = g_get_monotonic_time();
+
+	msg = g_strdup_printf(_("%s transfer: waiting for the remote..."), protocol_name(type));
+	progress_window_open(msg, G_CALLBACK(transfer_cancel));
+	g_free(msg);
+
+	return TRUE;
+}
+
+gboolean transfer_send(gint type, GSList *names)
+{
+	GStatBuf file_stat;
+	GSList *name;
+	gchar *msg;
+
+	files_total = 0;
+	for(name = names; name != NULL; name = name->next)
+	{
+		if(g_stat(name->data, &file_stat) == -1)
+			msg = g_strdup_printf(_("Cannot read file %s: %s\n"), (gchar *)name->data, strerror(errno));
+		else if(!S_ISREG(file_stat.st_mode))
+			msg = g_strdup_printf(_("Cannot read file %s: %s\n"), (gchar *)name->data, _("not a regular file"));
+		else
+			msg = NULL;
+
+		if(msg != NULL)
+		{
+			show_message(msg, MSG_ERR);
+			g_free(msg);
+			return FALSE;
+		}
+		files_total += file_stat.st_size;
+
+		/* XMODEM carries a single file */
+		if(type != TRANSFER_YMODEM && type != TRANSFER_ZMODEM)
+			break;
+	}
+
+	if(names == NULL || !transfer_begin(type, TRUE))
+		return FALSE;
+
+	if(type == TRANSFER_YMODEM || type == TRANSFER_ZMODEM)
+		files = g_slist_copy_deep(names, (GCopyFunc)g_strdup, NULL);
+	else
+		files = g_slist_append(NULL, g_strdup(names->data));
+
+	next_file();
+	if(ending)
+		return FALSE;
+
+	if(type == TRANSFER_ZMODEM)
+	{
+		/* starts rz on the other side when it is a shell */
+		send_bytes((const guint8 *)"rz\r", 3);
+		zsend_hex_header(ZRQINIT, 0);
+		state = ZS_WAIT_RINIT;
+	}
+	else
+		state = XS_WAIT_START;
+	arm_timeout(TRANSFER_TIMEOUT);
+
+	return TRUE;
+}
+
+gboolean transfer_receive(gint type, const gchar *path)
+{
+	gchar *msg;
+
+	if(!transfer_begin(type, FALSE))
+		return FALSE;
+
+	if(type == TRANSFER_XMODEM || type == TRANSFER_XMODEM_1K)
+	{
+		protocol = TRANSFER_XMODEM;
+		output = g_fopen(path, "wb");
+		if(output == NULL)
+		{
+			transfer_stop(MSG_ERR, g_strdup_printf(_("cannot open file %s: %s"), path, strerror(errno)));
+			return FALSE;
+		}
+		msg = g_strdup_printf(_("%s : %s transfer in progress..."), path, protocol_name(protocol));
+		progress_window_set_title(msg);
+		g_free(msg);
+	}
+	else
+		receive_path = g_strdup(path);
+
+	if(type == TRANSFER_ZMODEM)
+	{
+		state = ZR_RECEIVING;
+		zmodem_send_rinit();
+	}
+	else
+		xmodem_receive_start();
+
+	return TRUE;
+}
+
+/* Returns TRUE when the data belongs to a transfer */
+gboolean transfer_received(const gchar *chars, guint length)
+{
+	guint i;
+
+	if(protocol == TRANSFER_RAW)
+		return FALSE;
+
+	for(i = 0; i < length && !ending; i++)
+	{
+		if(protocol == TRANSFER_ZMODEM)
+			zmodem_byte(chars[i]);
+		else if(sending)
+			xmodem_sender(chars[i]);
+		else
+			xmodem_receiver(chars[i]);
+	}
+
+	if(!ending)
+		update_progress(FALSE);
+
+	return TRUE;
+}
+
+void transfer_append_statistics(GString *string)
+{
+	gdouble seconds;
+
+	if(last_protocol == TRANSFER_RAW)
+		return;
+
+	seconds = (gdouble)((protocol != TRANSFER_RAW ? g_get_monotonic_time() : last_end) - last_start) / G_USEC_PER_SEC;
+
+	g_string_append_printf(string,
+	                       _("File transfer (%s, %s%s):\n"
+	                         "  Files: %u, %" G_GUINT64_FORMAT " bytes in %.1f s\n"
+	                         "  Errors: %u\n"),
+	                       protocol_name(last_protocol),
+	                       last_sending ? _("sent") : _("received"),
+	                       protocol != TRANSFER_RAW ? _(", running") : "",
+	                       protocol != TRANSFER_RAW ? files_count : last_files,
+	                       protocol != TRANSFER_RAW ? (guint64)(files_done + file_pos) : last_bytes,
+	                       seconds, last_errors);
+}
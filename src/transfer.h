@@ -0,0 +1,40 @@
+/***********************************************************************/
+/* transfer.h                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      XMODEM, YMODEM and ZMODEM file transfers                       */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef TRANSFER_H_
+#define TRANSFER_H_
+
+#define TRANSFER_RAW 0
+#define TRANSFER_XMODEM 1
+#define TRANSFER_XMODEM_1K 2
+#define TRANSFER_YMODEM 3
+#define TRANSFER_ZMODEM 4
+
+#define TRANSFER_TIMEOUT 10000        /* without an answer, in ms */
+#define TRANSFER_RETRIES 10
+#define XMODEM_START_PERIOD 3000      /* between the 'C' of the receiver, in ms */
+#define XMODEM_START_RETRIES 20
+#define XMODEM_PURGE_TIMEOUT 1000     /* of silence after a bad block, in ms */
+#define ZMODEM_SUBPACKET 1024
+#define ZMODEM_MAX_SUBPACKET 8192     /* accepted from the sender */
+#define ZMODEM_WINDOW (64 * 1024)     /* unacknowledged data while streaming */
+#define ZMODEM_TX_LOW (16 * 1024)     /* more is sent when less is queued */
+#define ZMODEM_FINISH_TIMEOUT 1000    /* for the "OO" of the sender, in ms */
+
+gboolean transfer_send(gint, GSList *);
+gboolean transfer_receive(gint, const gchar *);
+gboolean transfer_received(const gchar *, guint);
+void transfer_append_statistics(GString *);
+
+#endif
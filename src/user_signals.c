@@ -14,8 +14,18 @@ static gboolean handle_usr2(gpointer user_data)
 	return G_SOURCE_CONTINUE;
 }
 
+/* Quit through the main loop, so the log file is written out */
+static gboolean handle_quit(gpointer user_data)
+{
+	gtk_main_quit();
+	return G_SOURCE_CONTINUE;
+}
+
 void user_signals_catch(void)
 {
 	g_unix_signal_add(SIGUSR1, (GSourceFunc) handle_usr1, NULL);
 	g_unix_signal_add(SIGUSR2, (GSourceFunc) handle_usr2, NULL);
+	g_unix_signal_add(SIGTERM, (GSourceFunc) handle_quit, NULL);
+	g_unix_signal_add(SIGINT, (GSourceFunc) handle_quit, NULL);
+	g_unix_signal_add(SIGHUP, (GSourceFunc) handle_quit, NULL);
 }